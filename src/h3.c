@@ -7,11 +7,47 @@
 #include "h3.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <lauxlib.h>
 #include <h3/h3api.h>
 
 
 static void check(lua_State *L, H3Error error);
+static H3Index *checkcells(lua_State *L, int index, size_t *len);
+static H3Index *checkpacked(lua_State *L, int index, size_t *len);
+static size_t checkpoints(lua_State *L, int index, const char **packed);
+static void getpoint(lua_State *L, int index, const char *packed, size_t i, LatLng *g);
+static void pushcells(lua_State *L, const H3Index *cells, int64_t num);
+static int optthreads(lua_State *L, int index);
+static double edgelength(lua_State *L, H3Index edge, int unit);
+static double greatcircle(const LatLng *a, const LatLng *b, int unit);
+static void sumadd(double *sum, double *compensation, double value);
+static int comparecells(const void *a, const void *b);
+static void *parallel_run(void *arg);
+static void parallel(int threads, int64_t num, h3_task task, void *arg);
+static void *memory_alloc(size_t size);
+static void *memory_calloc(size_t num, size_t size);
+static void *memory_realloc(void *ptr, size_t size);
+static void memory_free(void *ptr);
+static int memory_exceeds(const h3_memory *memory, size_t size);
+static void memory_enter(lua_State *L);
+static void *newbuffer(lua_State *L, size_t size);
+static size_t map_hash(H3Index key);
+static int map_init(h3_map *map, size_t count);
+static void map_free(h3_map *map);
+static int map_resize(h3_map *map, size_t size);
+static h3_value *map_get(const h3_map *map, H3Index key);
+static h3_value *map_put(h3_map *map, H3Index key);
+static void map_remove(h3_map *map, H3Index key);
+static h3_map *newmap(lua_State *L, size_t count);
+static int map_gc(lua_State *L);
 static int geopolygon_gc(lua_State *L);
 static int linkedgeopolygon_gc(lua_State *L);
 
@@ -29,44 +65,185 @@ static int h3_iscell(lua_State *L);
 static int h3_isresclassiii(lua_State *L);
 static int h3_ispentagon(lua_State *L);
 static int h3_icosahedronfaces(lua_State *L);
+static void resolutions_kernel(const H3Index *cells, unsigned char *out, size_t len);
+static void basecellnumbers_kernel(const H3Index *cells, unsigned char *out, size_t len);
+static void iscells_kernel(const H3Index *cells, unsigned char *out, size_t len);
+static void pushbytes(lua_State *L, const unsigned char *bytes, size_t len, int packed,
+		int boolean);
+static int h3_resolutions(lua_State *L);
+static int h3_basecellnumbers(lua_State *L);
+static int h3_iscells(lua_State *L);
 
 static int h3_griddisk(lua_State *L);
 static int h3_gridring(lua_State *L);
 static int h3_gridpathcells(lua_State *L);
+static void trajectory_append(lua_State *L, H3Index cell, size_t entry, H3Index *last,
+		int64_t *num);
+static int h3_trajectorytocells(lua_State *L);
 static int h3_griddistance(lua_State *L);
+static int64_t ijdistance(const CoordIJ *a, const CoordIJ *b);
+static void griddistances_task(void *arg, int64_t begin, int64_t end);
+static int h3_griddistances(lua_State *L);
+static void smoothcells_task(void *arg, int64_t begin, int64_t end);
+static int h3_smoothcells(lua_State *L);
 static int h3_celltolocalij(lua_State *L);
 static int h3_localijtocell(lua_State *L);
+static int h3_cellstogrid(lua_State *L);
+static int h3_gridtocells(lua_State *L);
 
 static int h3_celltoparent(lua_State *L);
+static int celltoparents_kernel(const H3Index *cells, H3Index *out, size_t len, int parentres);
+static int h3_celltoparents(lua_State *L);
 static int h3_celltochildren(lua_State *L);
 static int h3_celltocenterchild(lua_State *L);
 static int h3_celltochildpos(lua_State *L);
+static int h3_celltochildpositions(lua_State *L);
 static int h3_childpostocell(lua_State *L);
+static H3Index compactcells_parent(H3Index cell, int parentres);
+static void compactcells_task(void *arg, int64_t begin, int64_t end);
+static size_t compactcells(lua_State *L, H3Index *cells, size_t len, int threads);
 static int h3_compactcells(lua_State *L);
+static void uncompactcells_push(lua_State *L, H3Index cell, int res, lua_Integer *num);
 static int h3_uncompactcells(lua_State *L);
 
 static void geoloop (lua_State *L, int index, int loopindex, GeoLoop *loop);
+static void geopolygon(lua_State *L, int index, GeoPolygon *polygon);
+static void freegeopolygon(GeoPolygon *polygon);
 static int h3_polygontocells(lua_State *L);
+static int bbox_contains(const double *bbox, const LatLng *point);
+static void bbox_expand(const double *bbox, double margin, double *out);
+static void bbox_center(const double *bbox, LatLng *center);
+static double bbox_area(const double *bbox);
+static size_t bbox_cover(lua_State *L, const double *bbox, int res, size_t limit,
+		H3Index **cells);
+static int h3_bboxtocells(lua_State *L);
 static int h3_cellstopolygons(lua_State *L);
+static int h3_cellsperimeter(lua_State *L);
+static int compareranges(const void *a, const void *b);
+static void diffcells_range(H3Index cell, h3_range *range);
+static h3_range *diffcells_ranges(lua_State *L, int index, size_t *len);
+static void diffcells_subtract(lua_State *L, H3Index cell, const h3_range *ranges, size_t len,
+		lua_Integer *num);
+static int h3_diffcells(lua_State *L);
+static size_t tile_varint(unsigned char *p, uint64_t value);
+static void tile_addfield(luaL_Buffer *b, int tag, const unsigned char *data, size_t len);
+static int tile_clip(double *xs, double *ys, int n, int axis, double bound, int upper);
+static size_t tile_geometry(const CellBoundary *boundary, double tx, double ty, double scale,
+		int extent, unsigned char *p);
+static int h3_cellstotile(lua_State *L);
 
 static int h3_areneighborcells(lua_State *L);
 static int h3_cellstoedge(lua_State *L);
 static int h3_isedge(lua_State *L);
 static int h3_edgetocells(lua_State *L);
+static int h3_pathtoedges(lua_State *L);
+static int h3_edgelengths(lua_State *L);
+static int h3_edgestocells(lua_State *L);
+static int h3_aggregateflows(lua_State *L);
 static int h3_origintoedges(lua_State *L);
 static int h3_edgetoboundary(lua_State *L);
 
 static int h3_celltovertexes(lua_State *L);
 static int h3_vertextolatlng(lua_State *L);
 static int h3_isvertex(lua_State *L);
+static int h3_cellstomesh(lua_State *L);
 
 static int h3_hexagonavg(lua_State *L);
 static int h3_cellarea(lua_State *L);
+static void cellsarea_task(void *arg, int64_t begin, int64_t end);
+static int h3_cellsarea(lua_State *L);
 static int h3_edgelength(lua_State *L);
 static int h3_numcells(lua_State *L);
 static int h3_res0cells(lua_State *L);
 static int h3_pentagons(lua_State *L);
 static int h3_greatcircledistance(lua_State *L);
+static int h3_greatcircledistances(lua_State *L);
+static int h3_celldistances(lua_State *L);
+static int h3_cellswithinradius(lua_State *L);
+
+static int64_t pointindex_checkid(lua_State *L, int index);
+static int64_t pointindex_alloc(h3_pointindex *index);
+static void pointindex_release(h3_pointindex *index, int64_t p);
+static int pointindex_link(h3_pointindex *index, int64_t p);
+static void pointindex_unlink(h3_pointindex *index, int64_t p);
+static void pointindex_sift(h3_neighbor *heap, int64_t num, h3_neighbor entry);
+static void pointindex_push(h3_neighbor *heap, int64_t *num, int64_t k, double distance,
+		int64_t id);
+static int h3_memorylimit(lua_State *L);
+static int h3_memoryusage(lua_State *L);
+
+static int h3_pointindex_(lua_State *L);
+static int pointindex_insert(lua_State *L);
+static int pointindex_move(lua_State *L);
+static int pointindex_remove(lua_State *L);
+static int pointindex_get(lua_State *L);
+static int pointindex_knn(lua_State *L);
+static int pointindex_len(lua_State *L);
+static int pointindex_gc(lua_State *L);
+
+static h3_cellmap *newcellmap(lua_State *L, int integer);
+static void cellmap_pushvalue(lua_State *L, const h3_cellmap *cellmap, const h3_value *value);
+static h3_value cellmap_checkvalue(lua_State *L, const h3_cellmap *cellmap, int index);
+static void cellmap_combine(const h3_cellmap *cellmap, h3_value *value, h3_value operand,
+		int op);
+static int cellmap_update(lua_State *L, int op);
+static int h3_cellmap_(lua_State *L);
+static int cellmap_get(lua_State *L);
+static int cellmap_set(lua_State *L);
+static int cellmap_add(lua_State *L);
+static int cellmap_cells(lua_State *L);
+static int cellmap_merge(lua_State *L);
+static int cellmap_index(lua_State *L);
+static int cellmap_newindex(lua_State *L);
+static int cellmap_next(lua_State *L);
+static int cellmap_pairs(lua_State *L);
+static int cellmap_len(lua_State *L);
+static int cellmap_gc(lua_State *L);
+
+static int cellindex_open(lua_State *L, const char *path, h3_cellindex *index);
+static void cellindex_close(h3_cellindex *index);
+static int64_t cellindex_find(lua_State *L, const h3_cellindex *index, H3Index cell);
+static int cellindex_write(FILE *f, const h3_cellindexheader *header,
+		const h3_cellentry *entries, int ids);
+static int h3_writecellindex(lua_State *L);
+static int h3_opencellindex(lua_State *L);
+static int cellindex_contains(lua_State *L);
+static int cellindex_lookup(lua_State *L);
+static int cellindex_reload(lua_State *L);
+static int cellindex_len(lua_State *L);
+static int cellindex_gc(lua_State *L);
+
+static int loop_contains(const GeoLoop *loop, const LatLng *g);
+static int polygon_contains(const GeoPolygon *polygon, const LatLng *g);
+static int comparepolygons(const void *a, const void *b);
+static int polygonindex_candidate(h3_polygonindex *index, H3Index cell, int64_t polygon);
+static void polygonindex_cover(lua_State *L, h3_polygonindex *index, int64_t polygon,
+		h3_map *owners);
+static void polygonindex_trace(lua_State *L, h3_polygonindex *index, int64_t polygon,
+		const GeoLoop *loop);
+static void polygonindex_compact(lua_State *L, h3_polygonindex *index, h3_map *owners);
+static int64_t polygonindex_find(lua_State *L, const h3_polygonindex *index, const LatLng *g);
+static int h3_polygonindex_(lua_State *L);
+static int polygonindex_label(lua_State *L);
+static int polygonindex_len(lua_State *L);
+static int polygonindex_gc(lua_State *L);
+
+static int64_t cellcounter_bucket(const h3_cellcounter *counter, double time);
+static int64_t *cellcounter_counts(const h3_cellcounter *counter, int64_t s);
+static int64_t cellcounter_alloc(h3_cellcounter *counter);
+static void cellcounter_release(h3_cellcounter *counter, int64_t s);
+static void cellcounter_advance(h3_cellcounter *counter, int64_t s, int64_t bucket);
+static int64_t cellcounter_total(const h3_cellcounter *counter, int64_t s, int64_t now);
+static int64_t cellcounter_optnow(lua_State *L, const h3_cellcounter *counter, int index);
+static void cellcounter_sift(h3_cellcount *heap, int64_t num, h3_cellcount entry);
+static void cellcounter_push(h3_cellcount *heap, int64_t *num, int64_t n, int64_t count,
+		int64_t slot);
+static int h3_cellcounter_(lua_State *L);
+static int cellcounter_add(lua_State *L);
+static int cellcounter_count(lua_State *L);
+static int cellcounter_top(lua_State *L);
+static int cellcounter_len(lua_State *L);
+static int cellcounter_gc(lua_State *L);
 
 
 static const char *const H3_ERROR_MESSAGES[] = {
@@ -92,6 +269,12 @@ static const char *const EDGE_OPTIONS[] = { "both", "origin", "destination", NUL
 static const char *const HEXAGON_QUANTITIES[] = { "area", "edge", NULL };
 static const char *const HEXAGON_UNITS[] = { "m", "km", NULL };
 static const char *const GEO_UNITS[] = { "m", "km", "rad", NULL };
+static const char *const CELLMAP_TYPES[] = { "number", "integer", NULL };
+static const char *const CELLMAP_OPS[] = { "sum", "min", "max", NULL };
+static const char *const MATRIX_FORMATS[] = { "list", "packed", NULL };
+static const uint64_t PENTAGON_BASE_CELLS[] = { 0x8402004001004010ULL, 0x20080200080100ULL };
+
+static __thread h3_memory *memory_current;  /* memory of the current call */
 
 
 /*
@@ -108,16 +291,469 @@ static void check (lua_State *L, H3Error error) {
 	}
 }
 
+static H3Index *checkcells (lua_State *L, int index, size_t *len) {
+	size_t    i;
+	H3Index  *cells;
+
+	luaL_checktype(L, index, LUA_TTABLE);
+	*len = lua_rawlen(L, index);
+	cells = newbuffer(L, *len * sizeof(H3Index));
+	for (i = 0; i < *len; i++) {
+		if (lua_rawgeti(L, index, i + 1) != LUA_TNUMBER) {
+			luaL_error(L, "bad cell");
+		}
+		cells[i] = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	return cells;
+}
+
+static H3Index *checkpacked (lua_State *L, int index, size_t *len) {
+	size_t       size;
+	const char  *packed;
+	H3Index     *cells;
+
+	/* copies the packed native 64-bit integers, which keeps the buffer aligned */
+	packed = lua_tolstring(L, index, &size);
+	luaL_argcheck(L, size % sizeof(H3Index) == 0, index, "bad length");
+	*len = size / sizeof(H3Index);
+	cells = newbuffer(L, size);
+	memcpy(cells, packed, size);
+	return cells;
+}
+
+static size_t checkpoints (lua_State *L, int index, const char **packed) {
+	size_t  len;
+
+	/* a list of lists of latitude and longitude, or pairs of packed native doubles */
+	if (lua_type(L, index) == LUA_TSTRING) {
+		*packed = lua_tolstring(L, index, &len);
+		luaL_argcheck(L, len % (2 * sizeof(double)) == 0, index, "bad length");
+		return len / (2 * sizeof(double));
+	}
+	luaL_checktype(L, index, LUA_TTABLE);
+	*packed = NULL;
+	return lua_rawlen(L, index);
+}
+
+static void getpoint (lua_State *L, int index, const char *packed, size_t i, LatLng *g) {
+	double  coords[2];
+
+	if (packed != NULL) {
+		memcpy(coords, packed + i * sizeof(coords), sizeof(coords));
+	} else {
+		if (lua_rawgeti(L, index, i + 1) != LUA_TTABLE) {
+			luaL_error(L, "bad point");
+		}
+		if (lua_rawgeti(L, -1, 1) != LUA_TNUMBER || lua_rawgeti(L, -2, 2) != LUA_TNUMBER) {
+			luaL_error(L, "bad point");
+		}
+		coords[0] = lua_tonumber(L, -2);
+		coords[1] = lua_tonumber(L, -1);
+		lua_pop(L, 3);
+	}
+	g->lat = degsToRads(coords[0]);
+	g->lng = degsToRads(coords[1]);
+}
+
+static void pushcells (lua_State *L, const H3Index *cells, int64_t num) {
+	int64_t  i;
+
+	lua_createtable(L, num, 0);
+	for (i = 0; i < num; i++) {
+		lua_pushinteger(L, cells[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+}
+
+static int optthreads (lua_State *L, int index) {
+	int  threads;
+
+	threads = luaL_optinteger(L, index, 1);
+	luaL_argcheck(L, threads >= 1 && threads <= H3_THREADS_MAX, index, "bad number of threads");
+	return threads;
+}
+
+static double edgelength (lua_State *L, H3Index edge, int unit) {
+	double  length;
+
+	switch (unit) {
+	case 0:
+		check(L, edgeLengthM(edge, &length));
+		break;
+
+	case 1:
+		check(L, edgeLengthKm(edge, &length));
+		break;
+
+	default:
+		check(L, edgeLengthRads(edge, &length));
+		break;
+	}
+	return length;
+}
+
+static double greatcircle (const LatLng *a, const LatLng *b, int unit) {
+	switch (unit) {
+	case 0:
+		return greatCircleDistanceM(a, b);
+
+	case 1:
+		return greatCircleDistanceKm(a, b);
+
+	default:
+		return greatCircleDistanceRads(a, b);
+	}
+}
+
+static void sumadd (double *sum, double *compensation, double value) {
+	double  t;
+
+	/* Neumaier compensated summation; the result is sum + compensation */
+	t = *sum + value;
+	if (fabs(*sum) >= fabs(value)) {
+		*compensation += (*sum - t) + value;
+	} else {
+		*compensation += (value - t) + *sum;
+	}
+	*sum = t;
+}
+
+static int comparecells (const void *a, const void *b) {
+	H3Index  x, y;
+
+	x = *(const H3Index *)a;
+	y = *(const H3Index *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void *parallel_run (void *arg) {
+	h3_job  *job;
+
+	job = arg;
+	job->task(job->arg, job->begin, job->end);
+	return NULL;
+}
+
+static void parallel (int threads, int64_t num, h3_task task, void *arg) {
+	int        i, started;
+	h3_job     jobs[H3_THREADS_MAX];
+	pthread_t  tids[H3_THREADS_MAX];
+
+	if (threads > num) {
+		threads = num > 0 ? num : 1;
+	}
+	for (i = 0; i < threads; i++) {
+		jobs[i].task = task;
+		jobs[i].arg = arg;
+		jobs[i].begin = num * i / threads;
+		jobs[i].end = num * (i + 1) / threads;
+	}
+
+	/* start workers; if a thread cannot be created, its job runs on the caller */
+	started = 1;
+	while (started < threads && pthread_create(&tids[started], NULL, parallel_run,
+			&jobs[started]) == 0) {
+		started++;
+	}
+	task(arg, jobs[0].begin, jobs[0].end);
+	for (i = started; i < threads; i++) {
+		task(arg, jobs[i].begin, jobs[i].end);
+	}
+	for (i = 1; i < started; i++) {
+		pthread_join(tids[i], NULL);
+	}
+}
+
+static void *memory_alloc (size_t size) {
+	return memory_realloc(NULL, size);
+}
+
+static void *memory_calloc (size_t num, size_t size) {
+	void  *ptr;
+
+	if (size > 0 && num > SIZE_MAX / size) {
+		return NULL;
+	}
+	ptr = memory_alloc(num * size);
+	if (ptr != NULL) {
+		memset(ptr, 0, num * size);
+	}
+	return ptr;
+}
+
+static void *memory_realloc (void *ptr, size_t size) {
+	size_t      old;
+	h3_block   *block, *resized;
+	h3_memory  *memory;
+
+	/* blocks keep their memory; new blocks use the memory of the current call, if any */
+	if (ptr != NULL) {
+		block = (h3_block *)ptr - 1;
+		memory = block->memory;
+		old = block->size;
+	} else {
+		block = NULL;
+		memory = memory_current;
+		old = 0;
+	}
+	if (size > SIZE_MAX - sizeof(h3_block)) {
+		return NULL;
+	}
+	if (memory == NULL) {
+		resized = realloc(block, sizeof(h3_block) + size);
+	} else {
+		if (size > old && memory_exceeds(memory, size - old)) {
+			return NULL;
+		}
+		resized = memory->alloc(memory->ud, block, block != NULL ? sizeof(h3_block) + old : 0,
+				sizeof(h3_block) + size);
+		if (resized != NULL) {
+			memory->used = memory->used - old + size;
+		}
+	}
+	if (resized == NULL) {
+		return NULL;
+	}
+	resized->memory = memory;
+	resized->size = size;
+	return resized + 1;
+}
+
+static void memory_free (void *ptr) {
+	h3_block   *block;
+	h3_memory  *memory;
+
+	if (ptr == NULL) {
+		return;
+	}
+	block = (h3_block *)ptr - 1;
+	memory = block->memory;
+	if (memory == NULL) {
+		free(block);
+	} else {
+		memory->used -= block->size;
+		memory->alloc(memory->ud, block, sizeof(h3_block) + block->size, 0);
+	}
+}
+
+static int memory_exceeds (const h3_memory *memory, size_t size) {
+	return memory->limit > 0 && (int64_t)memory->used - (int64_t)memory->base
+			+ (int64_t)memory->buffers + (int64_t)size > (int64_t)memory->limit;
+}
+
+static void memory_enter (lua_State *L) {
+	h3_memory  *memory;
+
+	/* makes the memory current for the call; worker threads have no current memory */
+	memory = lua_touserdata(L, lua_upvalueindex(1));
+	memory_current = memory;
+	memory->base = memory->used;
+	memory->buffers = 0;
+}
+
+static void *newbuffer (lua_State *L, size_t size) {
+	h3_memory  *memory;
+
+	memory = memory_current;
+	if (memory->limit > 0) {
+		if (memory_exceeds(memory, size)) {
+			luaL_error(L, "out of memory");
+		}
+		memory->buffers += size;
+	}
+	return lua_newuserdata(L, size);
+}
+
+#ifdef H3_ALLOC_PREFIX
+void *H3_MEMORY_JOIN(H3_ALLOC_PREFIX, malloc) (size_t size) {
+	return memory_alloc(size);
+}
+
+void *H3_MEMORY_JOIN(H3_ALLOC_PREFIX, calloc) (size_t num, size_t size) {
+	return memory_calloc(num, size);
+}
+
+void *H3_MEMORY_JOIN(H3_ALLOC_PREFIX, realloc) (void *ptr, size_t size) {
+	return memory_realloc(ptr, size);
+}
+
+void H3_MEMORY_JOIN(H3_ALLOC_PREFIX, free) (void *ptr) {
+	memory_free(ptr);
+}
+#endif
+
+static size_t map_hash (H3Index key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (size_t)key;
+}
+
+static int map_init (h3_map *map, size_t count) {
+	size_t  size;
+
+	size = H3_MAP_MIN;
+	while (size / 2 < count) {
+		if (size > SIZE_MAX / 2 / sizeof(h3_value)) {
+			return -1;
+		}
+		size *= 2;
+	}
+	map->keys = memory_calloc(size, sizeof(H3Index));
+	map->values = memory_alloc(size * sizeof(h3_value));
+	if (map->keys == NULL || map->values == NULL) {
+		memory_free(map->keys);
+		memory_free(map->values);
+		map->keys = NULL;
+		map->values = NULL;
+		return -1;
+	}
+	map->size = size;
+	map->count = 0;
+	return 0;
+}
+
+static void map_free (h3_map *map) {
+	memory_free(map->keys);
+	memory_free(map->values);
+	map->keys = NULL;
+	map->values = NULL;
+	map->size = 0;
+	map->count = 0;
+}
+
+static int map_resize (h3_map *map, size_t size) {
+	size_t  i, j;
+	h3_map  resized;
+
+	if (size > SIZE_MAX / sizeof(h3_value)) {
+		return -1;
+	}
+	resized.keys = memory_calloc(size, sizeof(H3Index));
+	resized.values = memory_alloc(size * sizeof(h3_value));
+	if (resized.keys == NULL || resized.values == NULL) {
+		memory_free(resized.keys);
+		memory_free(resized.values);
+		return -1;
+	}
+	resized.size = size;
+	resized.count = map->count;
+	for (i = 0; i < map->size; i++) {
+		if (map->keys[i] != H3_NULL) {
+			j = map_hash(map->keys[i]) & (size - 1);
+			while (resized.keys[j] != H3_NULL) {
+				j = (j + 1) & (size - 1);
+			}
+			resized.keys[j] = map->keys[i];
+			resized.values[j] = map->values[i];
+		}
+	}
+	memory_free(map->keys);
+	memory_free(map->values);
+	*map = resized;
+	return 0;
+}
+
+static h3_value *map_get (const h3_map *map, H3Index key) {
+	size_t  i;
+
+	if (map->size == 0) {
+		return NULL;
+	}
+	i = map_hash(key) & (map->size - 1);
+	while (map->keys[i] != H3_NULL) {
+		if (map->keys[i] == key) {
+			return &map->values[i];
+		}
+		i = (i + 1) & (map->size - 1);
+	}
+	return NULL;
+}
+
+static h3_value *map_put (h3_map *map, H3Index key) {
+	size_t     i;
+	h3_value  *value;
+
+	value = map_get(map, key);
+	if (value != NULL) {
+		return value;
+	}
+	if ((map->count + 1) * 2 > map->size) {
+		if (map_resize(map, map->size > 0 ? map->size * 2 : H3_MAP_MIN) != 0) {
+			return NULL;
+		}
+	}
+	i = map_hash(key) & (map->size - 1);
+	while (map->keys[i] != H3_NULL) {
+		i = (i + 1) & (map->size - 1);
+	}
+	map->keys[i] = key;
+	map->values[i].i = 0;
+	map->count++;
+	return &map->values[i];
+}
+
+static void map_remove (h3_map *map, H3Index key) {
+	size_t  i, j, home;
+
+	if (map->size == 0) {
+		return;
+	}
+	i = map_hash(key) & (map->size - 1);
+	while (map->keys[i] != key) {
+		if (map->keys[i] == H3_NULL) {
+			return;
+		}
+		i = (i + 1) & (map->size - 1);
+	}
+
+	/* backward shift deletion; moves entries whose home slot is not in (i, j] */
+	j = i;
+	for (;;) {
+		j = (j + 1) & (map->size - 1);
+		if (map->keys[j] == H3_NULL) {
+			break;
+		}
+		home = map_hash(map->keys[j]) & (map->size - 1);
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			map->keys[i] = map->keys[j];
+			map->values[i] = map->values[j];
+			i = j;
+		}
+	}
+	map->keys[i] = H3_NULL;
+	map->count--;
+}
+
+static h3_map *newmap (lua_State *L, size_t count) {
+	h3_map  *map;
+
+	map = lua_newuserdata(L, sizeof(h3_map));
+	memset(map, 0, sizeof(h3_map));
+	luaL_getmetatable(L, H3_MAP);
+	lua_setmetatable(L, -2);
+	if (map_init(map, count) != 0) {
+		luaL_error(L, "out of memory");
+	}
+	return map;
+}
+
+static int map_gc (lua_State *L) {
+	h3_map  *map;
+
+	map = luaL_checkudata(L, 1, H3_MAP);
+	map_free(map);
+	return 0;
+}
+
 static int geopolygon_gc (lua_State *L) {
-	int          i;
 	GeoPolygon  *polygon;
 
 	polygon = luaL_checkudata(L, 1, H3_GEOPOLYGON);
-	free(polygon->geoloop.verts);
-	for (i = 0; i < polygon->numHoles; i++) {
-		free(polygon->holes[i].verts);
-	}
-	free(polygon->holes);
+	freegeopolygon(polygon);
 	return 0;
 }
 
@@ -275,6 +911,125 @@ static int h3_icosahedronfaces (lua_State *L) {
 	return 1;
 }
 
+#define ISCELLS_DIGITS  0x1fffffffffffULL  /* digit bits */
+#define ISCELLS_LOW     0x49249249249ULL   /* lowest bit of each digit */
+
+static H3_KERNEL void resolutions_kernel (const H3Index *cells, unsigned char *out, size_t len) {
+	size_t  i;
+
+	for (i = 0; i < len; i++) {
+		out[i] = (cells[i] >> 52) & 0xf;
+	}
+}
+
+static H3_KERNEL void basecellnumbers_kernel (const H3Index *cells, unsigned char *out,
+		size_t len) {
+	size_t  i;
+
+	for (i = 0; i < len; i++) {
+		out[i] = (cells[i] >> 45) & 0x7f;
+	}
+}
+
+static H3_KERNEL void iscells_kernel (const H3Index *cells, unsigned char *out, size_t len) {
+	size_t    i;
+	uint64_t  cell, base, res, unused, digits, sevens, first;
+
+	/* follows isValidCell: cell mode with clear high and reserved bits, a base cell, digits up
+	 * to the resolution other than 7, digits beyond it equal to 7, and no leading K axes digit
+	 * in a pentagon */
+	for (i = 0; i < len; i++) {
+		cell = cells[i];
+		base = (cell >> 45) & 0x7f;
+		res = (cell >> 52) & 0xf;
+		unused = (1ULL << 3 * (15 - res)) - 1;
+		digits = cell & ISCELLS_DIGITS & ~unused;
+		sevens = cell & cell >> 1 & cell >> 2 & ISCELLS_LOW & ~unused;
+		first = digits != 0 ? digits >> (63 - __builtin_clzll(digits)) / 3 * 3 : 0;
+		out[i] = (cell >> 56) == 0x08 && base < 122 && (cell & unused) == unused && sevens == 0
+				&& !(first == 1 && (PENTAGON_BASE_CELLS[base >> 6] >> (base & 0x3f) & 1));
+	}
+}
+
+static void pushbytes (lua_State *L, const unsigned char *bytes, size_t len, int packed,
+		int boolean) {
+	size_t  i;
+
+	if (packed) {
+		lua_pushlstring(L, (const char *)bytes, len);
+		return;
+	}
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		if (boolean) {
+			lua_pushboolean(L, bytes[i]);
+		} else {
+			lua_pushinteger(L, bytes[i]);
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+}
+
+static int h3_resolutions (lua_State *L) {
+	int             packed;
+	size_t          len;
+	H3Index        *cells;
+	unsigned char  *out;
+
+	memory_enter(L);
+	packed = lua_type(L, 1) == LUA_TSTRING;
+	cells = packed ? checkpacked(L, 1, &len) : checkcells(L, 1, &len);
+	out = newbuffer(L, len);
+	resolutions_kernel(cells, out, len);
+	pushbytes(L, out, len, packed, 0);
+	return 1;
+}
+
+static int h3_basecellnumbers (lua_State *L) {
+	int             packed;
+	size_t          len;
+	H3Index        *cells;
+	unsigned char  *out;
+
+	memory_enter(L);
+	packed = lua_type(L, 1) == LUA_TSTRING;
+	cells = packed ? checkpacked(L, 1, &len) : checkcells(L, 1, &len);
+	out = newbuffer(L, len);
+	basecellnumbers_kernel(cells, out, len);
+	pushbytes(L, out, len, packed, 0);
+	return 1;
+}
+
+static int h3_iscells (lua_State *L) {
+	int             packed;
+	size_t          len, i;
+	H3Index        *cells;
+	unsigned char  *out;
+
+	memory_enter(L);
+	packed = lua_type(L, 1) == LUA_TSTRING;
+	if (packed) {
+		cells = checkpacked(L, 1, &len);
+	} else {
+		/* entries that are not integers are checked as 0, which is not a cell */
+		luaL_checktype(L, 1, LUA_TTABLE);
+		len = lua_rawlen(L, 1);
+		cells = newbuffer(L, len * sizeof(H3Index));
+		for (i = 0; i < len; i++) {
+			if (lua_rawgeti(L, 1, i + 1) == LUA_TNUMBER && lua_isinteger(L, -1)) {
+				cells[i] = lua_tointeger(L, -1);
+			} else {
+				cells[i] = H3_NULL;
+			}
+			lua_pop(L, 1);
+		}
+	}
+	out = newbuffer(L, len);
+	iscells_kernel(cells, out, len);
+	pushbytes(L, out, len, packed, 1);
+	return 1;
+}
+
 
 /*
  * traversal
@@ -287,6 +1042,7 @@ static int h3_griddisk (lua_State *L) {
 	H3Index      origin, *out;
 	const char  *mode;
 
+	memory_enter(L);
 	origin = luaL_checkinteger(L, 1);
 	k = luaL_checkinteger(L, 2);
 	mode = luaL_optstring(L, 3, "");
@@ -296,7 +1052,7 @@ static int h3_griddisk (lua_State *L) {
 			out = alloca(num * sizeof(H3Index));
 			distances = alloca(num * sizeof(int));
 		} else {
-			out = lua_newuserdata(L, num * (sizeof(H3Index) + sizeof(int)));
+			out = newbuffer(L, num * (sizeof(H3Index) + sizeof(int)));
 			distances = (int *)(out + num);
 		}
 		if (strchr(mode, 'u')) {
@@ -317,7 +1073,7 @@ static int h3_griddisk (lua_State *L) {
 		if (num <= H3_STACK_MAX) {
 			out = alloca(num * sizeof(H3Index));
 		} else {
-			out = lua_newuserdata(L, num * sizeof(H3Index));
+			out = newbuffer(L, num * sizeof(H3Index));
 		}
 		if (strchr(mode, 'u')) {
 			check(L, gridDiskUnsafe(origin, k, out));
@@ -338,6 +1094,7 @@ static int h3_gridring (lua_State *L) {
 	int64_t  numOuter, numInner, num, i;
 	H3Index  origin, *out;
 
+	memory_enter(L);
 	origin = luaL_checkinteger(L, 1);
 	k = luaL_checkinteger(L, 2);
 	check(L, maxGridDiskSize(k, &numOuter));
@@ -350,7 +1107,7 @@ static int h3_gridring (lua_State *L) {
 	if (num <= H3_STACK_MAX) {
 		out = alloca(num * sizeof(H3Index));
 	} else {
-		out = lua_newuserdata(L, num * sizeof(H3Index));
+		out = newbuffer(L, num * sizeof(H3Index));
 	}
 	check(L, gridRingUnsafe(origin, k, out));
 	lua_createtable(L, num, 0);
@@ -365,13 +1122,14 @@ static int h3_gridpathcells (lua_State *L) {
 	int64_t  num, i;
 	H3Index  start, end, *out;
 
+	memory_enter(L);
 	start = luaL_checkinteger(L, 1);
 	end = luaL_checkinteger(L, 2);
 	check(L, gridPathCellsSize(start, end, &num));
 	if (num <= H3_STACK_MAX) {
 		out = alloca(num * sizeof(H3Index));
 	} else {
-		out = lua_newuserdata(L, num * sizeof(H3Index));
+		out = newbuffer(L, num * sizeof(H3Index));
 	}
 	check(L, gridPathCells(start, end, out));
 	lua_createtable(L, num, 0);
@@ -382,6 +1140,92 @@ static int h3_gridpathcells (lua_State *L) {
 	return 1;
 }
 
+static void trajectory_append (lua_State *L, H3Index cell, size_t entry, H3Index *last,
+		int64_t *num) {
+	if (cell != *last) {
+		(*num)++;
+		lua_pushinteger(L, cell);
+		lua_rawseti(L, 3, *num);
+		lua_pushinteger(L, entry);
+		lua_rawseti(L, 4, *num);
+		*last = cell;
+	}
+}
+
+static int h3_trajectorytocells (lua_State *L) {
+	int          res;
+	size_t       len, i;
+	double       edge, dlng;
+	LatLng       g, prev, sample;
+	int64_t      num, size, capacity, j, steps;
+	H3Index      cell, last, sampled, *path, *buffer;
+	const char  *packed;
+
+	memory_enter(L);
+	len = checkpoints(L, 1, &packed);
+	res = luaL_checkinteger(L, 2);
+	check(L, getHexagonEdgeLengthAvgKm(res, &edge));
+	lua_settop(L, 2);
+	lua_createtable(L, len, 0);  /* cells */
+	lua_createtable(L, len, 0);  /* entries */
+	lua_pushnil(L);  /* path buffer */
+	buffer = NULL;
+	capacity = 0;
+	num = 0;
+	last = H3_NULL;
+	prev.lat = prev.lng = 0.0;
+	for (i = 0; i < len; i++) {
+		getpoint(L, 1, packed, i, &g);
+		check(L, latLngToCell(&g, res, &cell));
+		if (last != H3_NULL && cell != last) {
+			/* fill the gap with the grid path; the gap cells are entered from the previous
+			 * point */
+			path = NULL;
+			if (gridPathCellsSize(last, cell, &size) == E_SUCCESS) {
+				if (size > capacity) {
+					capacity = size > 2 * capacity ? size : 2 * capacity;
+					buffer = newbuffer(L, capacity * sizeof(H3Index));
+					lua_replace(L, 5);
+				}
+				path = buffer;
+				if (gridPathCells(last, cell, path) != E_SUCCESS) {
+					path = NULL;
+				}
+			}
+			if (path != NULL) {
+				for (j = 1; j < size - 1; j++) {
+					trajectory_append(L, path[j], i, &last, &num);
+				}
+			} else {
+				/* no grid path, e.g., due to pentagonal distortion; sample the segment at
+				 * half the average edge length instead */
+				dlng = g.lng - prev.lng;
+				if (dlng > M_PI) {
+					dlng -= 2 * M_PI;
+				} else if (dlng < -M_PI) {
+					dlng += 2 * M_PI;
+				}
+				steps = ceil(greatCircleDistanceKm(&prev, &g) / edge * 2);
+				for (j = 1; j < steps; j++) {
+					sample.lat = prev.lat + (g.lat - prev.lat) * j / steps;
+					sample.lng = prev.lng + dlng * j / steps;
+					if (sample.lng > M_PI) {
+						sample.lng -= 2 * M_PI;
+					} else if (sample.lng < -M_PI) {
+						sample.lng += 2 * M_PI;
+					}
+					check(L, latLngToCell(&sample, res, &sampled));
+					trajectory_append(L, sampled, i, &last, &num);
+				}
+			}
+		}
+		trajectory_append(L, cell, i + 1, &last, &num);
+		prev = g;
+	}
+	lua_settop(L, 4);
+	return 2;
+}
+
 static int h3_griddistance (lua_State *L) {
 	int64_t  distance;
 	H3Index  origin, h3;
@@ -393,31 +1237,412 @@ static int h3_griddistance (lua_State *L) {
 	return 1;
 }
 
-static int h3_celltolocalij (lua_State *L) {
-	CoordIJ  out;
-	H3Index  origin, h3;
+static int64_t ijdistance (const CoordIJ *a, const CoordIJ *b) {
+	int64_t  di, dj;
 
-	origin = luaL_checkinteger(L, 1);
-	h3 = luaL_checkinteger(L, 2);
-	check(L, cellToLocalIj(origin, h3, 0, &out));
-	lua_pushinteger(L, out.i);
-	lua_pushinteger(L, out.j);
-	return 2;
+	/* IJ axes are 120 degrees apart; opposite signs walk around the third axis */
+	di = (int64_t)b->i - a->i;
+	dj = (int64_t)b->j - a->j;
+	if ((di >= 0) == (dj >= 0)) {
+		return llabs(di) > llabs(dj) ? llabs(di) : llabs(dj);
+	}
+	return llabs(di) + llabs(dj);
 }
 
-static int h3_localijtocell (lua_State *L) {
-	CoordIJ  ij;
-	H3Index  origin, out;
-
-	origin = luaL_checkinteger(L, 1);
-	ij.i = luaL_checkinteger(L, 2);
-	ij.j = luaL_checkinteger(L, 3);
-	check(L, localIjToCell(origin, &ij, 0, &out));
-	lua_pushinteger(L, out);
-	return 1;
+typedef struct griddistances_arg {
+	const H3Index  *origins;
+	const H3Index  *dests;
+	size_t          numDests;
+	int32_t        *out;
+} griddistances_arg;
+
+static void griddistances_task (void *arg, int64_t begin, int64_t end) {
+	size_t              j;
+	int32_t            *row;
+	int64_t             i, distance;
+	CoordIJ             a, b;
+	griddistances_arg  *gd;
+
+	/* native 32-bit integers, which also back the list format */
+	gd = arg;
+	for (i = begin; i < end; i++) {
+		row = gd->out + i * gd->numDests;
+		if (cellToLocalIj(gd->origins[i], gd->origins[i], 0, &a) != E_SUCCESS) {
+			for (j = 0; j < gd->numDests; j++) {
+				row[j] = -1;
+			}
+			continue;
+		}
+		for (j = 0; j < gd->numDests; j++) {
+			if (cellToLocalIj(gd->origins[i], gd->dests[j], 0, &b) == E_SUCCESS) {
+				distance = ijdistance(&a, &b);
+				row[j] = distance <= INT32_MAX ? (int32_t)distance : -1;
+			} else {
+				row[j] = -1;
+			}
+		}
+	}
 }
 
-
+static int h3_griddistances (lua_State *L) {
+	int                threads, format;
+	size_t             numOrigins, i;
+	griddistances_arg  gd;
+
+	memory_enter(L);
+	gd.origins = checkcells(L, 1, &numOrigins);
+	gd.dests = checkcells(L, 2, &gd.numDests);
+	threads = optthreads(L, 3);
+	format = luaL_checkoption(L, 4, "list", MATRIX_FORMATS);
+	if (numOrigins > 0 && gd.numDests > SIZE_MAX / sizeof(int32_t) / numOrigins) {
+		return luaL_error(L, "out of memory");
+	}
+	gd.out = newbuffer(L, numOrigins * gd.numDests * sizeof(int32_t));
+	parallel(threads, numOrigins, griddistances_task, &gd);
+	if (format == 1) {
+		lua_pushlstring(L, (const char *)gd.out, numOrigins * gd.numDests * sizeof(int32_t));
+		return 1;
+	}
+	lua_createtable(L, numOrigins * gd.numDests, 0);
+	for (i = 0; i < numOrigins * gd.numDests; i++) {
+		lua_pushinteger(L, gd.out[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+typedef struct smoothcells_arg {
+	const H3Index  *cells;      /* cells to smooth */
+	size_t          len;        /* number of cells */
+	const h3_map   *values;     /* values by cell */
+	const double   *weights;    /* weights by grid distance */
+	int             k;          /* maximum grid distance */
+	int64_t         size;       /* disk size */
+	H3Index        *disks;      /* disk buffers by chunk */
+	int            *distances;  /* distance buffers by chunk */
+	double         *out;        /* smoothed values */
+	int             chunks;     /* number of chunks */
+	H3Error         errors[H3_THREADS_MAX];
+} smoothcells_arg;
+
+static void smoothcells_task (void *arg, int64_t begin, int64_t end) {
+	int               c, *distances;
+	size_t            i;
+	double            sum;
+	int64_t           j;
+	H3Index          *disk;
+	h3_value         *value;
+	smoothcells_arg  *sc;
+
+	/* each item is a chunk of cells, reusing the disk buffers of the chunk */
+	sc = arg;
+	for (c = begin; c < end; c++) {
+		disk = sc->disks + c * sc->size;
+		distances = sc->distances + c * sc->size;
+		sc->errors[c] = E_SUCCESS;
+		for (i = sc->len * c / sc->chunks; i < sc->len * (c + 1) / sc->chunks; i++) {
+			memset(disk, 0, sc->size * sizeof(H3Index));
+			sc->errors[c] = gridDiskDistances(sc->cells[i], sc->k, disk, distances);
+			if (sc->errors[c] != E_SUCCESS) {
+				break;
+			}
+			sum = 0.0;
+			for (j = 0; j < sc->size; j++) {
+				if (disk[j] != H3_NULL && (value = map_get(sc->values, disk[j])) != NULL) {
+					sum += sc->weights[distances[j]] * value->n;
+				}
+			}
+			sc->out[i] = sum;
+		}
+	}
+}
+
+static int h3_smoothcells (lua_State *L) {
+	int               touched, c;
+	size_t            len, numWeights, i;
+	double           *weights;
+	int64_t           j;
+	h3_map           *values, *seen;
+	h3_value         *value;
+	H3Index          *cells, *all;
+	smoothcells_arg  *sc;
+
+	memory_enter(L);
+	cells = checkcells(L, 1, &len);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	touched = lua_toboolean(L, 4);
+	sc = lua_newuserdata(L, sizeof(smoothcells_arg));
+	sc->chunks = optthreads(L, 5);
+	numWeights = lua_rawlen(L, 3);
+	luaL_argcheck(L, numWeights >= 1, 3, "bad weights");
+	weights = newbuffer(L, numWeights * sizeof(double));
+	for (i = 0; i < numWeights; i++) {
+		if (lua_rawgeti(L, 3, i + 1) != LUA_TNUMBER) {
+			return luaL_error(L, "bad weight");
+		}
+		weights[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	sc->weights = weights;
+	sc->k = numWeights - 1;
+	check(L, maxGridDiskSize(sc->k, &sc->size));
+	values = newmap(L, len);
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 2, i + 1) != LUA_TNUMBER) {
+			return luaL_error(L, "bad value");
+		}
+		if (map_get(values, cells[i]) != NULL) {
+			return luaL_error(L, "duplicate input");
+		}
+		if ((value = map_put(values, cells[i])) == NULL) {
+			return luaL_error(L, "out of memory");
+		}
+		value->n = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	sc->values = values;
+	sc->disks = newbuffer(L, sc->chunks * sc->size * (sizeof(H3Index) + sizeof(int)));
+	sc->distances = (int *)(sc->disks + sc->chunks * sc->size);
+
+	/* touched cells follow the cells in the order they are first reached */
+	all = cells;
+	sc->len = len;
+	if (touched) {
+		seen = newmap(L, len);
+		for (i = 0; i < len; i++) {
+			memset(sc->disks, 0, sc->size * sizeof(H3Index));
+			check(L, gridDisk(cells[i], sc->k, sc->disks));
+			for (j = 0; j < sc->size; j++) {
+				if (sc->disks[j] == H3_NULL || map_get(values, sc->disks[j]) != NULL
+						|| map_get(seen, sc->disks[j]) != NULL) {
+					continue;
+				}
+				if ((value = map_put(seen, sc->disks[j])) == NULL) {
+					return luaL_error(L, "out of memory");
+				}
+				value->i = seen->count - 1;
+			}
+		}
+		all = newbuffer(L, (len + seen->count) * sizeof(H3Index));
+		memcpy(all, cells, len * sizeof(H3Index));
+		for (i = 0; i < seen->size; i++) {
+			if (seen->keys[i] != H3_NULL) {
+				all[len + seen->values[i].i] = seen->keys[i];
+			}
+		}
+		sc->len += seen->count;
+	}
+	sc->cells = all;
+	sc->out = newbuffer(L, sc->len * sizeof(double));
+	parallel(sc->chunks, sc->chunks, smoothcells_task, sc);
+	for (c = 0; c < sc->chunks; c++) {
+		check(L, sc->errors[c]);
+	}
+
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		lua_pushnumber(L, sc->out[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	if (!touched) {
+		return 1;
+	}
+	pushcells(L, all + len, sc->len - len);
+	lua_createtable(L, sc->len - len, 0);
+	for (i = len; i < sc->len; i++) {
+		lua_pushnumber(L, sc->out[i]);
+		lua_rawseti(L, -2, i - len + 1);
+	}
+	return 3;
+}
+
+static int h3_celltolocalij (lua_State *L) {
+	CoordIJ  out;
+	H3Index  origin, h3;
+
+	origin = luaL_checkinteger(L, 1);
+	h3 = luaL_checkinteger(L, 2);
+	check(L, cellToLocalIj(origin, h3, 0, &out));
+	lua_pushinteger(L, out.i);
+	lua_pushinteger(L, out.j);
+	return 2;
+}
+
+static int h3_localijtocell (lua_State *L) {
+	CoordIJ  ij;
+	H3Index  origin, out;
+
+	origin = luaL_checkinteger(L, 1);
+	ij.i = luaL_checkinteger(L, 2);
+	ij.j = luaL_checkinteger(L, 3);
+	check(L, localIjToCell(origin, &ij, 0, &out));
+	lua_pushinteger(L, out);
+	return 1;
+}
+
+static int h3_cellstogrid (lua_State *L) {
+	int       fill, format;
+	double   *packed;
+	size_t    len, i;
+	int64_t   imin, imax, jmin, jmax, width, height, k;
+	H3Index   origin, *cells;
+	CoordIJ  *ijs;
+
+	memory_enter(L);
+	origin = luaL_checkinteger(L, 1);
+	cells = checkcells(L, 2, &len);
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+	}
+	if (!lua_isnoneornil(L, 4)) {
+		luaL_checknumber(L, 4);
+		lua_pushvalue(L, 4);
+	} else {
+		lua_pushinteger(L, 0);
+	}
+	fill = lua_gettop(L);
+	format = luaL_checkoption(L, 5, "list", MATRIX_FORMATS);
+
+	/* bounds of the local IJ coordinates */
+	ijs = newbuffer(L, len * sizeof(CoordIJ));
+	imin = jmin = 0;
+	imax = jmax = -1;
+	for (i = 0; i < len; i++) {
+		check(L, cellToLocalIj(origin, cells[i], 0, &ijs[i]));
+		if (i == 0 || ijs[i].i < imin) {
+			imin = ijs[i].i;
+		}
+		if (i == 0 || ijs[i].i > imax) {
+			imax = ijs[i].i;
+		}
+		if (i == 0 || ijs[i].j < jmin) {
+			jmin = ijs[i].j;
+		}
+		if (i == 0 || ijs[i].j > jmax) {
+			jmax = ijs[i].j;
+		}
+	}
+	width = imax - imin + 1;
+	height = jmax - jmin + 1;
+	if (width * height > H3_GRID_MAX) {
+		return luaL_error(L, "grid too large");
+	}
+
+	/* row-major grid, with rows along J; the packed grid holds native doubles */
+	if (format == 1) {
+		packed = newbuffer(L, width * height * sizeof(double));
+		for (k = 0; k < width * height; k++) {
+			packed[k] = lua_tonumber(L, fill);
+		}
+		for (i = 0; i < len; i++) {
+			k = (ijs[i].j - jmin) * width + (ijs[i].i - imin);
+			if (lua_isnoneornil(L, 3)) {
+				packed[k] = 1;
+				continue;
+			}
+			if (lua_rawgeti(L, 3, i + 1) != LUA_TNUMBER) {
+				return luaL_error(L, "bad value");
+			}
+			packed[k] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		lua_pushlstring(L, (const char *)packed, width * height * sizeof(double));
+	} else {
+		lua_createtable(L, width * height, 0);
+		for (k = 0; k < width * height; k++) {
+			lua_pushvalue(L, fill);
+			lua_rawseti(L, -2, k + 1);
+		}
+		for (i = 0; i < len; i++) {
+			k = (ijs[i].j - jmin) * width + (ijs[i].i - imin);
+			if (lua_isnoneornil(L, 3)) {
+				lua_pushinteger(L, 1);
+			} else if (lua_rawgeti(L, 3, i + 1) != LUA_TNUMBER) {
+				return luaL_error(L, "bad value");
+			}
+			lua_rawseti(L, -2, k + 1);
+		}
+	}
+	lua_pushinteger(L, width);
+	lua_pushinteger(L, height);
+	lua_pushinteger(L, imin);
+	lua_pushinteger(L, jmin);
+	return 5;
+}
+
+static int h3_gridtocells (lua_State *L) {
+	int          packed;
+	size_t       len, i;
+	double       value, fill;
+	int64_t      width, imin, jmin;
+	lua_Integer  n;
+	CoordIJ      ij;
+	H3Index      origin, cell;
+	const char  *grid;
+
+	origin = luaL_checkinteger(L, 1);
+	packed = lua_type(L, 2) == LUA_TSTRING;
+	if (!packed) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+	}
+	width = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, width >= 1, 3, "bad width");
+	imin = luaL_checkinteger(L, 4);
+	jmin = luaL_checkinteger(L, 5);
+	if (!lua_isnoneornil(L, 6)) {
+		luaL_checknumber(L, 6);
+	} else {
+		lua_settop(L, 5);
+		lua_pushinteger(L, 0);
+	}
+	lua_newtable(L);
+	lua_newtable(L);
+	n = 0;
+	if (packed) {
+		/* native doubles */
+		grid = lua_tolstring(L, 2, &len);
+		luaL_argcheck(L, len % sizeof(double) == 0, 2, "bad length");
+		len /= sizeof(double);
+		fill = lua_tonumber(L, 6);
+		for (i = 0; i < len; i++) {
+			memcpy(&value, grid + i * sizeof(double), sizeof(double));
+			if (value == fill) {
+				continue;
+			}
+			ij.i = imin + (int64_t)i % width;
+			ij.j = jmin + (int64_t)i / width;
+			check(L, localIjToCell(origin, &ij, 0, &cell));
+			n++;
+			lua_pushnumber(L, value);
+			lua_rawseti(L, -2, n);
+			lua_pushinteger(L, cell);
+			lua_rawseti(L, -3, n);
+		}
+		return 2;
+	}
+	len = lua_rawlen(L, 2);
+	for (i = 0; i < len; i++) {
+		lua_rawgeti(L, 2, i + 1);
+		if (lua_isnil(L, -1) || lua_rawequal(L, -1, 6)) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if (lua_type(L, -1) != LUA_TNUMBER) {
+			return luaL_error(L, "bad value");
+		}
+		ij.i = imin + (int64_t)i % width;
+		ij.j = jmin + (int64_t)i / width;
+		check(L, localIjToCell(origin, &ij, 0, &cell));
+		n++;
+		lua_rawseti(L, -2, n);
+		lua_pushinteger(L, cell);
+		lua_rawseti(L, -3, n);
+	}
+	return 2;
+}
+
+
 /*
  * hierarchy
  */
@@ -433,18 +1658,60 @@ static int h3_celltoparent (lua_State *L) {
 	return 1;
 }
 
+static H3_KERNEL int celltoparents_kernel (const H3Index *cells, H3Index *out, size_t len,
+		int parentres) {
+	int       mismatch;
+	size_t    i;
+	uint64_t  res, digits;
+
+	/* sets the resolution, and the digits finer than the parent resolution to 7 */
+	mismatch = 0;
+	for (i = 0; i < len; i++) {
+		res = (cells[i] >> 52) & 0xf;
+		mismatch |= res < (uint64_t)parentres;
+		digits = ((1ULL << 3 * (15 - parentres)) - 1) & ~((1ULL << 3 * (15 - res)) - 1);
+		out[i] = (cells[i] & ~(0xfULL << 52)) | (uint64_t)parentres << 52 | digits;
+	}
+	return mismatch;
+}
+
+static int h3_celltoparents (lua_State *L) {
+	int       parentres, packed;
+	size_t    len;
+	H3Index  *cells, *parents;
+
+	memory_enter(L);
+	packed = lua_type(L, 1) == LUA_TSTRING;
+	cells = packed ? checkpacked(L, 1, &len) : checkcells(L, 1, &len);
+	parentres = luaL_checkinteger(L, 2);
+	if (parentres < 0 || parentres > 15) {
+		check(L, E_RES_DOMAIN);
+	}
+	parents = newbuffer(L, len * sizeof(H3Index));
+	if (celltoparents_kernel(cells, parents, len, parentres)) {
+		check(L, E_RES_MISMATCH);
+	}
+	if (packed) {
+		lua_pushlstring(L, (const char *)parents, len * sizeof(H3Index));
+	} else {
+		pushcells(L, parents, len);
+	}
+	return 1;
+}
+
 static int h3_celltochildren (lua_State *L) {
 	int      childres;
 	int64_t  num, i;
 	H3Index  cell, *children;
 
+	memory_enter(L);
 	cell = luaL_checkinteger(L, 1);
 	childres = luaL_checkinteger(L, 2);
 	check(L, cellToChildrenSize(cell, childres, &num));
 	if (num <= H3_STACK_MAX) {
 		children = alloca(num * sizeof(H3Index));
 	} else {
-		children = lua_newuserdata(L, num * sizeof(H3Index));
+		children = newbuffer(L, num * sizeof(H3Index));
 	}
 	check(L, cellToChildren(cell, childres, children));
 	lua_createtable(L, num, 0);
@@ -478,6 +1745,32 @@ static int h3_celltochildpos (lua_State *L) {
 	return 1;
 }
 
+static int h3_celltochildpositions (lua_State *L) {
+	int       parentres, packed;
+	size_t    len, i;
+	int64_t  *out;
+	H3Index  *cells;
+
+	memory_enter(L);
+	packed = lua_type(L, 1) == LUA_TSTRING;
+	cells = packed ? checkpacked(L, 1, &len) : checkcells(L, 1, &len);
+	parentres = luaL_checkinteger(L, 2);
+	out = newbuffer(L, len * sizeof(int64_t));
+	for (i = 0; i < len; i++) {
+		check(L, cellToChildPos(cells[i], parentres, &out[i]));
+	}
+	if (packed) {
+		lua_pushlstring(L, (const char *)out, len * sizeof(int64_t));
+		return 1;
+	}
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		lua_pushinteger(L, out[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
 static int h3_childpostocell (lua_State *L) {
 	int       childres;
 	int64_t   childpos;
@@ -491,71 +1784,174 @@ static int h3_childpostocell (lua_State *L) {
 	return 1;
 }
 
-static int h3_compactcells (lua_State *L) {
-	size_t    len, i;
-	H3Index  *cellSet, *compactedSet;
+typedef struct compactcells_arg {
+	int       res;           /* resolution of the cells */
+	H3Index  *cells;         /* cells, grouped by base cell */
+	H3Index  *out;           /* compacted cells, same grouping */
+	int64_t   starts[123];   /* group offsets by base cell */
+	int64_t   counts[122];   /* compacted counts by base cell */
+	H3Error   errors[122];   /* errors by base cell */
+} compactcells_arg;
+
+static H3Index compactcells_parent (H3Index cell, int parentres) {
+	/* digits finer than the parent resolution are 7 in valid cells already */
+	return (cell & ~(0xfULL << 52)) | (uint64_t)parentres << 52
+			| ((1ULL << 3 * (15 - parentres)) - 1);
+}
 
-	luaL_checktype(L, 1, LUA_TTABLE);
-	len = lua_rawlen(L, 1);
-	if (len <= H3_STACK_MAX / 2) {
-		cellSet = alloca(len * sizeof(H3Index));
-		compactedSet = alloca(len * sizeof(H3Index));
-	} else {
-		cellSet = lua_newuserdata(L, (len + len) * sizeof(H3Index));
-		compactedSet = cellSet + len;
+static void compactcells_task (void *arg, int64_t begin, int64_t end) {
+	int                res;
+	int64_t            b, i, j, m, n, promoted;
+	H3Index            parent, *cells, *out;
+	compactcells_arg  *cc;
+
+	cc = arg;
+	for (b = begin; b < end; b++) {
+		cells = cc->cells + cc->starts[b];
+		out = cc->out + cc->starts[b];
+		m = cc->starts[b + 1] - cc->starts[b];
+		n = 0;
+		qsort(cells, m, sizeof(H3Index), comparecells);
+		for (i = 1; i < m; i++) {
+			if (cells[i] == cells[i - 1]) {
+				cc->errors[b] = E_DUPLICATE_INPUT;
+				m = 0;
+				break;
+			}
+		}
+
+		/* promotes complete sibling groups level by level; the parents stay sorted */
+		for (res = cc->res; res > 0 && m > 0; res--) {
+			promoted = 0;
+			for (i = 0; i < m; i = j) {
+				parent = compactcells_parent(cells[i], res - 1);
+				for (j = i + 1; j < m && compactcells_parent(cells[j], res - 1) == parent;
+						j++);
+				if (j - i == (isPentagon(parent) ? 6 : 7)) {
+					cells[promoted++] = parent;
+				} else {
+					memcpy(out + n, cells + i, (j - i) * sizeof(H3Index));
+					n += j - i;
+				}
+			}
+			m = promoted;
+		}
+		memcpy(out + n, cells, m * sizeof(H3Index));
+		cc->counts[b] = n + m;
 	}
+}
+
+static size_t compactcells (lua_State *L, H3Index *cells, size_t len, int threads) {
+	int                res, base;
+	size_t             i;
+	int64_t            b, offsets[122];
+	compactcells_arg  *cc;
+
+	cc = lua_newuserdata(L, sizeof(compactcells_arg));
+	memset(cc, 0, sizeof(compactcells_arg));
+	cc->res = len > 0 ? (int)((cells[0] >> 52) & 0xf) : 0;
+
+	/* groups the cells by base cell, which compacts independently */
 	for (i = 0; i < len; i++) {
-		if (lua_rawgeti(L, 1, i + 1) != LUA_TNUMBER) {
-			return luaL_error(L, "bad cell");
+		res = (cells[i] >> 52) & 0xf;
+		base = (cells[i] >> 45) & 0x7f;
+		if (res != cc->res) {
+			check(L, E_RES_MISMATCH);
 		}
-		cellSet[i] = lua_tointeger(L, -1);
-		lua_pop(L, 1);
+		if (base >= 122) {
+			check(L, E_CELL_INVALID);
+		}
+		cc->starts[base + 1]++;
 	}
-	memset(compactedSet, 0, len * sizeof(H3Index));
-	check(L, compactCells(cellSet, compactedSet, len));
-	while (len > 0 && compactedSet[len - 1] == 0) {
-		len--;
+	for (b = 0; b < 122; b++) {
+		cc->starts[b + 1] += cc->starts[b];
+		offsets[b] = cc->starts[b];
 	}
-	lua_createtable(L, len, 0);
+	cc->cells = newbuffer(L, len * sizeof(H3Index));
 	for (i = 0; i < len; i++) {
-		lua_pushinteger(L, compactedSet[i]);
-		lua_rawseti(L, -2, i + 1);
+		cc->cells[offsets[(cells[i] >> 45) & 0x7f]++] = cells[i];
+	}
+	cc->out = cells;
+	parallel(threads, 122, compactcells_task, cc);
+	for (b = 0; b < 122; b++) {
+		check(L, cc->errors[b]);
 	}
+
+	/* moves the compacted cells to the front */
+	i = 0;
+	for (b = 0; b < 122; b++) {
+		memmove(cells + i, cells + cc->starts[b], cc->counts[b] * sizeof(H3Index));
+		i += cc->counts[b];
+	}
+	lua_pop(L, 2);
+	return i;
+}
+
+static int h3_compactcells (lua_State *L) {
+	int       threads;
+	size_t    len;
+	H3Index  *cells;
+
+	memory_enter(L);
+	cells = checkcells(L, 1, &len);
+	threads = optthreads(L, 2);
+	len = compactcells(L, cells, len, threads);
+	pushcells(L, cells, len);
 	return 1;
 }
 
-static int h3_uncompactcells (lua_State *L) {
-	int       res;
-	size_t    len, i;
-	int64_t   num, j;
-	H3Index  *compactedSet, *cellSet;
+static void uncompactcells_push (lua_State *L, H3Index cell, int res, lua_Integer *num) {
+	int       cellres, d, pentagon, digit;
+	H3Index   child;
 
-	luaL_checktype(L, 1, LUA_TTABLE);
-	res = luaL_checkinteger(L, 2);
-	len = lua_rawlen(L, 1);
-	if (len <= H3_STACK_MAX / 2) {
-		compactedSet = alloca(len * sizeof(H3Index));
-	} else {
-		compactedSet = lua_newuserdata(L, len * sizeof(H3Index));
-	}
-	for (i = 0; i < len; i++) {
-		if (lua_rawgeti(L, 1, i + 1) != LUA_TNUMBER) {
-			return luaL_error(L, "bad cell");
+	cellres = (cell >> 52) & 0xf;
+	check(L, cellToCenterChild(cell, res, &child));
+	pentagon = isPentagon(cell);
+
+	/* enumerates the child digits as a base-7 odometer, skipping the deleted
+	 * pentagon subsequences whose first non-zero digit is 1 */
+	for (;;) {
+		if (pentagon) {
+			for (d = cellres + 1, digit = 0; d <= res && digit == 0; d++) {
+				digit = (child >> 3 * (15 - d)) & 7;
+			}
+		}
+		if (!pentagon || digit != 1) {
+			lua_pushinteger(L, child);
+			lua_rawseti(L, -2, ++*num);
+		}
+		for (d = res; d > cellres; d--) {
+			if (((child >> 3 * (15 - d)) & 7) < 6) {
+				child += 1ULL << 3 * (15 - d);
+				break;
+			}
+			child &= ~(7ULL << 3 * (15 - d));
+		}
+		if (d == cellres) {
+			break;
 		}
-		compactedSet[i] = lua_tointeger(L, -1);
-		lua_pop(L, 1);
 	}
+}
+
+static int h3_uncompactcells (lua_State *L) {
+	int          res;
+	size_t       len, i;
+	int64_t      num;
+	lua_Integer  n;
+	H3Index     *compactedSet;
+
+	memory_enter(L);
+	compactedSet = checkcells(L, 1, &len);
+	res = luaL_checkinteger(L, 2);
 	check(L, uncompactCellsSize(compactedSet, len, res, &num));
-	if (num <= H3_STACK_MAX / 2) {
-		cellSet = alloca(num * sizeof(H3Index));
-	} else {
-		cellSet = lua_newuserdata(L, num * sizeof(H3Index));
-	}
-	check(L, uncompactCells(compactedSet, len, cellSet, num, res));
+
+	/* writes the children directly into the result */
 	lua_createtable(L, num, 0);
-	for (j = 0; j < num; j++) {
-		lua_pushinteger(L, cellSet[j]);
-		lua_rawseti(L, -2, j + 1);
+	n = 0;
+	for (i = 0; i < len; i++) {
+		if (compactedSet[i] != H3_NULL) {
+			uncompactcells_push(L, compactedSet[i], res, &n);
+		}
 	}
 	return 1;
 }
@@ -575,7 +1971,7 @@ static void geoloop (lua_State *L, int index, int loopindex, GeoLoop *loop) {
 	if (len < 4) {
 		luaL_error(L, "bad polygon");
 	}
-	loop->verts = malloc(len * sizeof(LatLng));
+	loop->verts = memory_alloc(len * sizeof(LatLng));
 	if (loop->verts == NULL) {
 		luaL_error(L, "out of memory");
 	}
@@ -594,13 +1990,45 @@ static void geoloop (lua_State *L, int index, int loopindex, GeoLoop *loop) {
 	lua_pop(L, 1);
 }
 
+static void geopolygon (lua_State *L, int index, GeoPolygon *polygon) {
+	size_t  len, i;
+
+	len = lua_rawlen(L, index);
+	if (len < 1) {
+		luaL_error(L, "bad polygon");
+	}
+	geoloop(L, index, 1, &polygon->geoloop);
+	if (len > 1) {
+		polygon->holes = memory_alloc((len - 1) * sizeof(GeoLoop));
+		if (polygon->holes == NULL) {
+			luaL_error(L, "out of memory");
+		}
+		memset(polygon->holes, 0, (len - 1) * sizeof(GeoLoop));
+		polygon->numHoles = len - 1;
+		for (i = 1; i < len; i++) {
+			geoloop(L, index, i + 1, &polygon->holes[i - 1]);
+		}
+	}
+}
+
+static void freegeopolygon (GeoPolygon *polygon) {
+	int  i;
+
+	memory_free(polygon->geoloop.verts);
+	for (i = 0; i < polygon->numHoles; i++) {
+		memory_free(polygon->holes[i].verts);
+	}
+	memory_free(polygon->holes);
+}
+
 static int h3_polygontocells (lua_State *L) {
 	int          res;
-	size_t       len, i;
+	size_t       len;
 	int64_t      num, numSet, j, k;
 	GeoPolygon  *polygon;
 	H3Index     *out;
 
+	memory_enter(L);
 	luaL_checktype(L, 1, LUA_TTABLE);
 	len = lua_rawlen(L, 1);
 	luaL_argcheck(L, len > 0, 1, "bad polygon");
@@ -609,23 +2037,12 @@ static int h3_polygontocells (lua_State *L) {
 	memset(polygon, 0, sizeof(GeoPolygon));
 	luaL_getmetatable(L, H3_GEOPOLYGON);
 	lua_setmetatable(L, -2);
-	geoloop(L, 1, 1, &polygon->geoloop);
-	if (len > 1) {
-		polygon->holes = malloc((len - 1) * sizeof(GeoLoop));
-		if (polygon->holes == NULL) {
-			luaL_error(L, "out of memory");
-		}
-		memset(polygon->holes, 0, (len - 1) * sizeof(GeoLoop));
-		polygon->numHoles = len - 1;
-		for (i = 1; i < len; i++) {
-			geoloop(L, 1, i + 1, &polygon->holes[i - 1]);
-		}
-	}
+	geopolygon(L, 1, polygon);
 	check(L, maxPolygonToCellsSize(polygon, res, 0, &num));
 	if (num <= H3_STACK_MAX) {
 		out = alloca(num * sizeof(H3Index));
 	} else {
-		out = lua_newuserdata(L, num * sizeof(H3Index));
+		out = newbuffer(L, num * sizeof(H3Index));
 	}
 	memset(out, 0, num * sizeof(H3Index));
 	check(L, polygonToCells(polygon, res, 0, out));
@@ -646,33 +2063,247 @@ static int h3_polygontocells (lua_State *L) {
 	return 1;
 }
 
-static int h3_cellstopolygons (lua_State *L) {
-	size_t             len, i, j, k;
-	H3Index           *h3Set;
-	LinkedLatLng      *latLng;
-	LinkedGeoLoop     *loop;
-	LinkedGeoPolygon  *polygon;
+static int bbox_contains (const double *bbox, const LatLng *point) {
+	if (point->lat < bbox[0] || point->lat > bbox[2]) {
+		return 0;
+	}
+	if (bbox[1] <= bbox[3]) {
+		return point->lng >= bbox[1] && point->lng <= bbox[3];
+	}
+	return point->lng >= bbox[1] || point->lng <= bbox[3];  /* crosses the antimeridian */
+}
 
-	luaL_checktype(L, 1, LUA_TTABLE);
-	len = lua_rawlen(L, 1);
-	if (len <= H3_STACK_MAX) {
-		h3Set = alloca(len * sizeof(H3Index));
-	} else {
-		h3Set = lua_newuserdata(L, len * sizeof(H3Index));
+static void bbox_expand (const double *bbox, double margin, double *out) {
+	double  width, lat, lngMargin;
+
+	out[0] = fmax(bbox[0] - margin, -M_PI / 2);
+	out[2] = fmin(bbox[2] + margin, M_PI / 2);
+	width = bbox[3] - bbox[1];
+	if (width < 0) {
+		width += 2 * M_PI;
 	}
-	for (i = 0; i < len; i++) {
-		if (lua_rawgeti(L, 1, i + 1) != LUA_TNUMBER) {
-			return luaL_error(L, "bad cell");
-		}
-		h3Set[i] = lua_tointeger(L, -1);
-		lua_pop(L, 1);
+	lat = fmax(fabs(out[0]), fabs(out[2]));
+	lngMargin = margin / cos(lat);
+	if (width + 2 * lngMargin >= 2 * M_PI) {
+		out[1] = -M_PI;
+		out[3] = M_PI;
+		return;
 	}
-	polygon = lua_newuserdata(L, sizeof(LinkedGeoPolygon));
-	memset(polygon, 0, sizeof(LinkedGeoPolygon));
-	luaL_getmetatable(L, H3_LINKEDGEOPOLYGON);
-	lua_setmetatable(L, -2);
-	check(L, cellsToLinkedMultiPolygon(h3Set, len, polygon));
-	lua_newtable(L);
+	out[1] = bbox[1] - lngMargin;
+	if (out[1] < -M_PI) {
+		out[1] += 2 * M_PI;
+	}
+	out[3] = bbox[3] + lngMargin;
+	if (out[3] > M_PI) {
+		out[3] -= 2 * M_PI;
+	}
+}
+
+static void bbox_center (const double *bbox, LatLng *center) {
+	center->lat = (bbox[0] + bbox[2]) / 2;
+	center->lng = (bbox[1] + bbox[3]) / 2;
+	if (bbox[1] > bbox[3]) {
+		center->lng += center->lng > 0 ? -M_PI : M_PI;
+	}
+}
+
+static double bbox_area (const double *bbox) {
+	double  width;
+
+	width = bbox[3] - bbox[1];
+	if (width < 0) {
+		width += 2 * M_PI;
+	}
+	return H3_EARTH_RADIUS_KM * H3_EARTH_RADIUS_KM * (sin(bbox[2]) - sin(bbox[0])) * width;
+}
+
+static size_t bbox_cover (lua_State *L, const double *bbox, int res, size_t limit,
+		H3Index **cells) {
+	int        j, index;
+	double     edge, expanded[4];
+	size_t     size, head, tail, num, i;
+	LatLng     center;
+	h3_map    *map;
+	h3_value  *value;
+	H3Index   *queue, *grown, disk[7];
+
+	/* flood fills the cells with their center in the box expanded by a margin, which keeps
+	 * the cells connected if the box is narrow; returns SIZE_MAX if the fill exceeds the
+	 * limit, unless the limit is 0 */
+	check(L, getHexagonEdgeLengthAvgKm(res, &edge));
+	bbox_expand(bbox, 2 * edge / H3_EARTH_RADIUS_KM, expanded);
+	bbox_center(bbox, &center);
+	map = newmap(L, 0);
+	index = lua_gettop(L) + 1;
+	size = H3_MAP_MIN;
+	queue = newbuffer(L, size * sizeof(H3Index));
+	check(L, latLngToCell(&center, res, &queue[0]));
+	if ((value = map_put(map, queue[0])) == NULL) {
+		luaL_error(L, "out of memory");
+	}
+	check(L, cellToLatLng(queue[0], &center));
+	value->i = bbox_contains(bbox, &center);
+	head = 0;
+	tail = 1;
+	while (head < tail) {
+		memset(disk, 0, sizeof(disk));
+		check(L, gridDisk(queue[head++], 1, disk));
+		for (j = 0; j < 7; j++) {
+			if (disk[j] == H3_NULL || map_get(map, disk[j]) != NULL) {
+				continue;
+			}
+			if ((value = map_put(map, disk[j])) == NULL) {
+				luaL_error(L, "out of memory");
+			}
+			check(L, cellToLatLng(disk[j], &center));
+			if (!bbox_contains(expanded, &center)) {
+				value->i = -1;
+				continue;
+			}
+			value->i = bbox_contains(bbox, &center);
+			if (limit > 0 && tail == limit) {
+				return SIZE_MAX;
+			}
+			if (tail == size) {
+				size *= 2;
+				grown = newbuffer(L, size * sizeof(H3Index));
+				memcpy(grown, queue, tail * sizeof(H3Index));
+				lua_replace(L, index);
+				queue = grown;
+			}
+			queue[tail++] = disk[j];
+		}
+	}
+
+	/* keeps the cells with their center in the box */
+	num = 0;
+	for (i = 0; i < tail; i++) {
+		if (map_get(map, queue[i])->i == 1) {
+			queue[num++] = queue[i];
+		}
+	}
+	*cells = queue;
+	return num;
+}
+
+static int h3_bboxtocells (lua_State *L) {
+	int           res, r, top;
+	double        bbox[4], area, cellArea;
+	size_t        limit, num, compactedNum, finerNum, i, j;
+	LatLng        center;
+	lua_Integer   max;
+	H3Index      *cells, *compacted, *finer;
+
+	memory_enter(L);
+	bbox[0] = degsToRads(luaL_checknumber(L, 1));
+	bbox[1] = degsToRads(luaL_checknumber(L, 2));
+	bbox[2] = degsToRads(luaL_checknumber(L, 3));
+	bbox[3] = degsToRads(luaL_checknumber(L, 4));
+	res = luaL_checkinteger(L, 5);
+	luaL_argcheck(L, bbox[0] >= -M_PI / 2 && bbox[0] <= bbox[2] && bbox[2] <= M_PI / 2, 3,
+			"bad latitude");
+	luaL_argcheck(L, bbox[1] >= -M_PI && bbox[1] <= M_PI, 2, "bad longitude");
+	luaL_argcheck(L, bbox[3] >= -M_PI && bbox[3] <= M_PI, 4, "bad longitude");
+	if (res < 0 || res > 15) {
+		check(L, E_RES_DOMAIN);
+	}
+	if (lua_isnoneornil(L, 6)) {
+		num = bbox_cover(L, bbox, res, 0, &cells);
+		pushcells(L, cells, num);
+		return 1;
+	}
+	max = luaL_checkinteger(L, 6);
+	luaL_argcheck(L, max >= 1, 6, "bad maximum");
+
+	/* starts at the finest resolution whose estimated cover is within the limit, and coarsens
+	 * if the cover exceeds the limit nevertheless; resolution 0 is never limited */
+	limit = (size_t)max <= H3_GRID_MAX / H3_BBOX_SPAN ? (size_t)max * H3_BBOX_SPAN
+			: H3_GRID_MAX;
+	area = bbox_area(bbox);
+	for (r = res; r > 0; r--) {
+		check(L, getHexagonAreaAvgKm2(r, &cellArea));
+		if (area / cellArea <= limit) {
+			break;
+		}
+	}
+	top = lua_gettop(L);
+	while ((num = bbox_cover(L, bbox, r, r > 0 ? limit : 0, &cells)) == SIZE_MAX) {
+		lua_settop(L, top);
+		r--;
+	}
+	if (num == 0) {
+		bbox_center(bbox, &center);
+		check(L, latLngToCell(&center, r, &cells[0]));
+		num = 1;
+	}
+	compacted = newbuffer(L, num * sizeof(H3Index));
+	memcpy(compacted, cells, num * sizeof(H3Index));
+	compactedNum = compactcells(L, compacted, num, 1);
+
+	/* refines while the compacted cover of the finer resolution satisfies the maximum */
+	while (compactedNum <= (size_t)max && r < res) {
+		finerNum = bbox_cover(L, bbox, r + 1, limit, &finer);
+		if (finerNum == SIZE_MAX || finerNum == 0) {
+			break;
+		}
+		finerNum = compactcells(L, finer, finerNum, 1);
+		if (finerNum > (size_t)max) {
+			break;
+		}
+		compacted = finer;
+		compactedNum = finerNum;
+		r++;
+	}
+
+	/* otherwise, compacts the parents of the cover from fine to coarse, returning the finest
+	 * within the maximum */
+	while (compactedNum > (size_t)max && r > 0) {
+		r--;
+		for (i = 0; i < num; i++) {
+			check(L, cellToParent(cells[i], r, &cells[i]));
+		}
+		qsort(cells, num, sizeof(H3Index), comparecells);
+		for (i = 1, j = 1; i < num; i++) {
+			if (cells[i] != cells[j - 1]) {
+				cells[j++] = cells[i];
+			}
+		}
+		num = j;
+		memcpy(compacted, cells, num * sizeof(H3Index));
+		compactedNum = compactcells(L, compacted, num, 1);
+	}
+	pushcells(L, compacted, compactedNum);
+	return 1;
+}
+
+static int h3_cellstopolygons (lua_State *L) {
+	size_t             len, i, j, k;
+	H3Index           *h3Set;
+	LinkedLatLng      *latLng;
+	LinkedGeoLoop     *loop;
+	LinkedGeoPolygon  *polygon;
+
+	memory_enter(L);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	len = lua_rawlen(L, 1);
+	if (len <= H3_STACK_MAX) {
+		h3Set = alloca(len * sizeof(H3Index));
+	} else {
+		h3Set = newbuffer(L, len * sizeof(H3Index));
+	}
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 1, i + 1) != LUA_TNUMBER) {
+			return luaL_error(L, "bad cell");
+		}
+		h3Set[i] = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	polygon = lua_newuserdata(L, sizeof(LinkedGeoPolygon));
+	memset(polygon, 0, sizeof(LinkedGeoPolygon));
+	luaL_getmetatable(L, H3_LINKEDGEOPOLYGON);
+	lua_setmetatable(L, -2);
+	check(L, cellsToLinkedMultiPolygon(h3Set, len, polygon));
+	lua_newtable(L);
 	i = 0;
 	while (polygon != NULL) {
 		lua_newtable(L);
@@ -700,6 +2331,451 @@ static int h3_cellstopolygons (lua_State *L) {
 	return 1;
 }
 
+static int h3_cellsperimeter (lua_State *L) {
+	int       unit, j, boundary;
+	size_t    len, i;
+	double    perimeter;
+	h3_map   *set;
+	H3Index  *cells, edges[6], destination;
+	int64_t   numCells, numEdges;
+
+	memory_enter(L);
+	cells = checkcells(L, 1, &len);
+	unit = luaL_checkoption(L, 2, "m", GEO_UNITS);
+	set = newmap(L, len);
+	for (i = 0; i < len; i++) {
+		if (map_get(set, cells[i]) != NULL) {
+			return luaL_error(L, "duplicate input");
+		}
+		if (map_put(set, cells[i]) == NULL) {
+			return luaL_error(L, "out of memory");
+		}
+	}
+	lua_createtable(L, 0, 0);
+	lua_createtable(L, 0, 0);
+	numCells = 0;
+	numEdges = 0;
+	perimeter = 0.0;
+	for (i = 0; i < len; i++) {
+		check(L, originToDirectedEdges(cells[i], edges));
+		boundary = 0;
+		for (j = 0; j < 6; j++) {
+			if (edges[j] == H3_NULL) {
+				continue;
+			}
+			check(L, getDirectedEdgeDestination(edges[j], &destination));
+			if (map_get(set, destination) != NULL) {
+				continue;
+			}
+			perimeter += edgelength(L, edges[j], unit);
+			lua_pushinteger(L, edges[j]);
+			lua_rawseti(L, -2, ++numEdges);
+			boundary = 1;
+		}
+		if (boundary) {
+			lua_pushinteger(L, cells[i]);
+			lua_rawseti(L, -3, ++numCells);
+		}
+	}
+	lua_pushnumber(L, perimeter);
+	return 3;
+}
+
+static int compareranges (const void *a, const void *b) {
+	const h3_range  *x, *y;
+
+	/* ancestors sort before their descendants sharing the same start */
+	x = a;
+	y = b;
+	if (x->lo != y->lo) {
+		return x->lo < y->lo ? -1 : 1;
+	}
+	return x->hi > y->hi ? -1 : x->hi < y->hi;
+}
+
+static void diffcells_range (H3Index cell, h3_range *range) {
+	int  res;
+
+	/* the descendants of a cell are ordered between its zero and seven digit suffixes */
+	res = (cell >> 52) & 0xf;
+	range->hi = cell | 0xfULL << 52;
+	range->lo = range->hi & ~((1ULL << 3 * (15 - res)) - 1);
+	range->cell = cell;
+}
+
+static h3_range *diffcells_ranges (lua_State *L, int index, size_t *len) {
+	size_t     i, n;
+	H3Index   *cells;
+	h3_range  *ranges;
+
+	cells = checkcells(L, index, len);
+	ranges = newbuffer(L, *len * sizeof(h3_range));
+	for (i = 0; i < *len; i++) {
+		if (!isValidCell(cells[i])) {
+			check(L, E_CELL_INVALID);
+		}
+		diffcells_range(cells[i], &ranges[i]);
+	}
+
+	/* sorts the ranges, and drops the ranges contained in a preceding range */
+	qsort(ranges, *len, sizeof(h3_range), compareranges);
+	n = 0;
+	for (i = 0; i < *len; i++) {
+		if (n == 0 || ranges[i].lo > ranges[n - 1].hi) {
+			ranges[n++] = ranges[i];
+		}
+	}
+	*len = n;
+	return ranges;
+}
+
+static void diffcells_subtract (lua_State *L, H3Index cell, const h3_range *ranges, size_t len,
+		lua_Integer *num) {
+	int       res, digit, pentagon;
+	size_t    lo, hi, mid;
+	H3Index   child;
+	h3_range  range;
+
+	/* finds the first range that does not end before the cell */
+	diffcells_range(cell, &range);
+	lo = 0;
+	hi = len;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ranges[mid].hi < range.lo) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == len || ranges[lo].lo > range.hi) {
+		lua_pushinteger(L, cell);
+		lua_rawseti(L, -2, ++*num);
+		return;
+	}
+	if (ranges[lo].lo <= range.lo && ranges[lo].hi >= range.hi) {
+		return;
+	}
+
+	/* partially covered; splits the cell into its children */
+	res = (cell >> 52) & 0xf;
+	if (res == 15) {
+		return;  /* not reached */
+	}
+	pentagon = isPentagon(cell);
+	for (digit = 0; digit < 7; digit++) {
+		if (pentagon && digit == 1) {
+			continue;
+		}
+		child = (cell & ~(0xfULL << 52) & ~(7ULL << 3 * (14 - res))) | (uint64_t)(res + 1) << 52
+				| (uint64_t)digit << 3 * (14 - res);
+		diffcells_subtract(L, child, ranges, len, num);
+	}
+}
+
+static int h3_diffcells (lua_State *L) {
+	size_t        oldLen, newLen, i;
+	h3_range     *oldRanges, *newRanges;
+	lua_Integer   num;
+
+	memory_enter(L);
+	oldRanges = diffcells_ranges(L, 1, &oldLen);
+	newRanges = diffcells_ranges(L, 2, &newLen);
+	lua_createtable(L, 0, 0);
+	num = 0;
+	for (i = 0; i < newLen; i++) {
+		diffcells_subtract(L, newRanges[i].cell, oldRanges, oldLen, &num);
+	}
+	lua_createtable(L, 0, 0);
+	num = 0;
+	for (i = 0; i < oldLen; i++) {
+		diffcells_subtract(L, oldRanges[i].cell, newRanges, newLen, &num);
+	}
+	return 2;
+}
+
+#define TILE_VERTS_MAX  (MAX_CELL_BNDRY_VERTS + 4)  /* maximum clipped ring vertexes */
+#define TILE_BUFFER     (1.0 / 64)                  /* clip buffer, relative to the extent */
+
+static size_t tile_varint (unsigned char *p, uint64_t value) {
+	size_t  n;
+
+	n = 0;
+	while (value >= 0x80) {
+		p[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	p[n++] = value;
+	return n;
+}
+
+static void tile_addfield (luaL_Buffer *b, int tag, const unsigned char *data, size_t len) {
+	size_t         n;
+	unsigned char  header[16];
+
+	/* length-delimited field */
+	header[0] = tag << 3 | 2;
+	n = 1 + tile_varint(header + 1, len);
+	luaL_addlstring(b, (const char *)header, n);
+	luaL_addlstring(b, (const char *)data, len);
+}
+
+static int tile_clip (double *xs, double *ys, int n, int axis, double bound, int upper) {
+	int     i, j, m, in, previn;
+	double  x[TILE_VERTS_MAX], y[TILE_VERTS_MAX], v, prev, t;
+
+	/* Sutherland-Hodgman against one side of the clip box; a convex ring gains at most one
+	 * vertex per side */
+	memcpy(x, xs, n * sizeof(double));
+	memcpy(y, ys, n * sizeof(double));
+	m = 0;
+	for (i = 0, j = n - 1; i < n; j = i++) {
+		v = axis ? y[i] : x[i];
+		prev = axis ? y[j] : x[j];
+		in = upper ? v <= bound : v >= bound;
+		previn = upper ? prev <= bound : prev >= bound;
+		if (in != previn && m < TILE_VERTS_MAX) {
+			t = (bound - prev) / (v - prev);
+			xs[m] = axis ? x[j] + (x[i] - x[j]) * t : bound;
+			ys[m] = axis ? bound : y[j] + (y[i] - y[j]) * t;
+			m++;
+		}
+		if (in && m < TILE_VERTS_MAX) {
+			xs[m] = x[i];
+			ys[m] = y[i];
+			m++;
+		}
+	}
+	return m;
+}
+
+static size_t tile_geometry (const CellBoundary *boundary, double tx, double ty, double scale,
+		int extent, unsigned char *p) {
+	int       i, n, xs[TILE_VERTS_MAX], ys[TILE_VERTS_MAX], px, py;
+	size_t    len;
+	double    lat, dx, minx, maxx, miny, maxy, buffer;
+	double    wx[TILE_VERTS_MAX], wy[TILE_VERTS_MAX];
+	int64_t   area;
+	uint32_t  commands[3 + 2 * TILE_VERTS_MAX];
+
+	/* projects to Web Mercator in units of tiles, unwrapping the antimeridian */
+	if (boundary->numVerts < 3) {
+		return 0;
+	}
+	for (i = 0; i < boundary->numVerts; i++) {
+		lat = fmax(fmin(boundary->verts[i].lat, H3_TILE_LAT), -H3_TILE_LAT);
+		wx[i] = (boundary->verts[i].lng / M_PI + 1) / 2 * scale;
+		wy[i] = (1 - log(tan(lat) + 1 / cos(lat)) / M_PI) / 2 * scale;
+		if (i > 0 && wx[i] - wx[0] > scale / 2) {
+			wx[i] -= scale;
+		} else if (i > 0 && wx[i] - wx[0] < -scale / 2) {
+			wx[i] += scale;
+		}
+	}
+	minx = maxx = wx[0];
+	miny = maxy = wy[0];
+	for (i = 1; i < boundary->numVerts; i++) {
+		minx = fmin(minx, wx[i]);
+		maxx = fmax(maxx, wx[i]);
+		miny = fmin(miny, wy[i]);
+		maxy = fmax(maxy, wy[i]);
+	}
+
+	/* selects the cell, or its copy one world to the left or right, if it intersects */
+	dx = 0.0;
+	if (maxx < tx) {
+		dx = scale;
+	} else if (minx > tx + 1) {
+		dx = -scale;
+	}
+	if (maxx + dx < tx || minx + dx > tx + 1 || maxy < ty || miny > ty + 1) {
+		return 0;
+	}
+
+	/* clips to the tile and its buffer in tile coordinates */
+	n = boundary->numVerts;
+	for (i = 0; i < n; i++) {
+		wx[i] = (wx[i] + dx - tx) * extent;
+		wy[i] = (wy[i] - ty) * extent;
+	}
+	buffer = ceil(extent * TILE_BUFFER);
+	n = tile_clip(wx, wy, n, 0, -buffer, 0);
+	n = tile_clip(wx, wy, n, 0, extent + buffer, 1);
+	n = tile_clip(wx, wy, n, 1, -buffer, 0);
+	n = tile_clip(wx, wy, n, 1, extent + buffer, 1);
+
+	/* rounds, dropping repeated points and empty rings */
+	len = n;
+	n = 0;
+	for (i = 0; i < (int)len; i++) {
+		xs[n] = lround(wx[i]);
+		ys[n] = lround(wy[i]);
+		if (n == 0 || xs[n] != xs[n - 1] || ys[n] != ys[n - 1]) {
+			n++;
+		}
+	}
+	while (n > 1 && xs[n - 1] == xs[0] && ys[n - 1] == ys[0]) {
+		n--;
+	}
+	area = 0;
+	for (i = 0; i < n; i++) {
+		area += (int64_t)xs[i] * ys[(i + 1) % n] - (int64_t)xs[(i + 1) % n] * ys[i];
+	}
+	if (n < 3 || area == 0) {
+		return 0;
+	}
+
+	/* exterior rings have a positive area, i.e., are clockwise with Y pointing down */
+	if (area < 0) {
+		for (i = 0; i < n / 2; i++) {
+			px = xs[i];
+			xs[i] = xs[n - 1 - i];
+			xs[n - 1 - i] = px;
+			py = ys[i];
+			ys[i] = ys[n - 1 - i];
+			ys[n - 1 - i] = py;
+		}
+	}
+
+	/* MoveTo, LineTo, and ClosePath with zigzag-encoded deltas */
+	len = 0;
+	px = py = 0;
+	commands[len++] = 1 | 1 << 3;
+	for (i = 0; i < n; i++) {
+		if (i == 1) {
+			commands[len++] = 2 | (n - 1) << 3;
+		}
+		commands[len++] = (uint32_t)(xs[i] - px) << 1 ^ (uint32_t)((xs[i] - px) >> 31);
+		commands[len++] = (uint32_t)(ys[i] - py) << 1 ^ (uint32_t)((ys[i] - py) >> 31);
+		px = xs[i];
+		py = ys[i];
+	}
+	commands[len++] = 7 | 1 << 3;
+	n = 0;
+	for (i = 0; i < (int)len; i++) {
+		n += tile_varint(p + n, commands[i]);
+	}
+	return n;
+}
+
+static int h3_cellstotile (lua_State *L) {
+	int            z, x, y, extent, hasValues;
+	size_t         len, i, numValues, n, geometryLen, tagsLen, nameLen, layerLen;
+	double         scale, value, *values, *uniqueValues;
+	uint64_t       bits;
+	h3_map        *map;
+	h3_value      *entry;
+	H3Index       *cells;
+	luaL_Buffer    b;
+	const char    *name, *layer;
+	CellBoundary   boundary;
+	lua_Integer    numFeatures;
+	unsigned char  geometry[H3_TILE_GEOMETRY_MAX], tags[16];
+	unsigned char  feature[H3_TILE_GEOMETRY_MAX + 64];
+
+	memory_enter(L);
+	cells = checkcells(L, 1, &len);
+	hasValues = !lua_isnoneornil(L, 2);
+	if (hasValues) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+	}
+	z = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, z >= 0 && z <= 30, 3, "bad zoom");
+	x = luaL_checkinteger(L, 4);
+	luaL_argcheck(L, x >= 0 && x < 1 << z, 4, "bad tile");
+	y = luaL_checkinteger(L, 5);
+	luaL_argcheck(L, y >= 0 && y < 1 << z, 5, "bad tile");
+	extent = luaL_optinteger(L, 6, 4096);
+	luaL_argcheck(L, extent >= 1 && extent <= 1 << 16, 6, "bad extent");
+	name = luaL_optlstring(L, 7, "h3", &nameLen);
+	scale = 1 << z;
+
+	/* values are deduplicated by their bits, with negative zero normalized */
+	values = NULL;
+	uniqueValues = NULL;
+	map = NULL;
+	if (hasValues) {
+		values = newbuffer(L, len * 2 * sizeof(double));
+		uniqueValues = values + len;
+		for (i = 0; i < len; i++) {
+			if (lua_rawgeti(L, 2, i + 1) != LUA_TNUMBER) {
+				return luaL_error(L, "bad value");
+			}
+			values[i] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		map = newmap(L, 0);
+	}
+
+	luaL_buffinit(L, &b);
+	numValues = 0;
+	numFeatures = 0;
+	for (i = 0; i < len; i++) {
+		check(L, cellToBoundary(cells[i], &boundary));
+		geometryLen = tile_geometry(&boundary, x, y, scale, extent, geometry);
+		if (geometryLen == 0) {
+			continue;
+		}
+		n = 0;
+		feature[n++] = 1 << 3;
+		n += tile_varint(feature + n, cells[i]);
+		if (hasValues) {
+			value = values[i] == 0.0 ? 0.0 : values[i];
+			memcpy(&bits, &value, sizeof(bits));
+			if ((entry = map_put(map, bits ^ 0x8000000000000000ULL)) == NULL) {
+				return luaL_error(L, "out of memory");
+			}
+			if (entry->i == 0) {
+				uniqueValues[numValues++] = value;
+				entry->i = numValues;
+			}
+			tags[0] = 0;
+			tagsLen = 1 + tile_varint(tags + 1, entry->i - 1);
+			feature[n++] = 2 << 3 | 2;
+			n += tile_varint(feature + n, tagsLen);
+			memcpy(feature + n, tags, tagsLen);
+			n += tagsLen;
+		}
+		feature[n++] = 3 << 3;
+		feature[n++] = 3;
+		feature[n++] = 4 << 3 | 2;
+		n += tile_varint(feature + n, geometryLen);
+		memcpy(feature + n, geometry, geometryLen);
+		n += geometryLen;
+		tile_addfield(&b, 2, feature, n);
+		numFeatures++;
+	}
+
+	/* name, keys, values, extent, and version */
+	tile_addfield(&b, 1, (const unsigned char *)name, nameLen);
+	if (hasValues) {
+		tile_addfield(&b, 3, (const unsigned char *)"value", 5);
+		for (i = 0; i < numValues; i++) {
+			memcpy(&bits, &uniqueValues[i], sizeof(bits));
+			feature[0] = 3 << 3 | 1;
+			for (n = 0; n < 8; n++) {
+				feature[1 + n] = bits >> 8 * n;
+			}
+			tile_addfield(&b, 4, feature, 9);
+		}
+	}
+	n = 0;
+	feature[n++] = 5 << 3;
+	n += tile_varint(feature + n, extent);
+	feature[n++] = 15 << 3;
+	feature[n++] = 2;
+	luaL_addlstring(&b, (const char *)feature, n);
+	luaL_pushresult(&b);
+
+	/* tile with a single layer */
+	layer = lua_tolstring(L, -1, &layerLen);
+	luaL_buffinit(L, &b);
+	tile_addfield(&b, 3, (const unsigned char *)layer, layerLen);
+	luaL_pushresult(&b);
+	lua_pushinteger(L, numFeatures);
+	return 2;
+}
+
 
 /*
  * directed edge
@@ -762,6 +2838,126 @@ static int h3_edgetocells (lua_State *L) {
 	}
 }
 
+static int h3_pathtoedges (lua_State *L) {
+	size_t    len, i;
+	H3Index  *cells, edge;
+
+	memory_enter(L);
+	cells = checkcells(L, 1, &len);
+	lua_createtable(L, len > 0 ? len - 1 : 0, 0);
+	for (i = 1; i < len; i++) {
+		check(L, cellsToDirectedEdge(cells[i - 1], cells[i], &edge));
+		lua_pushinteger(L, edge);
+		lua_rawseti(L, -2, i);
+	}
+	return 1;
+}
+
+static int h3_edgelengths (lua_State *L) {
+	int       unit;
+	size_t    len, i;
+	H3Index  *edges;
+
+	memory_enter(L);
+	edges = checkcells(L, 1, &len);
+	unit = luaL_checkoption(L, 2, "m", GEO_UNITS);
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		lua_pushnumber(L, edgelength(L, edges[i], unit));
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+static int h3_edgestocells (lua_State *L) {
+	size_t    len, i;
+	H3Index  *edges, originDestination[2];
+
+	memory_enter(L);
+	edges = checkcells(L, 1, &len);
+	lua_createtable(L, len, 0);
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		check(L, directedEdgeToCells(edges[i], originDestination));
+		lua_pushinteger(L, originDestination[0]);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushinteger(L, originDestination[1]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+
+static int h3_aggregateflows (lua_State *L) {
+	int          flows;
+	size_t       numPaths, len, p, i;
+	H3Index      previous, cell, edge;
+	h3_value     operand, *value;
+	h3_cellmap  *cellmap;
+
+	memory_enter(L);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	flows = lua_type(L, 2) == LUA_TTABLE;
+	numPaths = lua_rawlen(L, 1);
+	if (flows) {
+		luaL_argcheck(L, lua_rawlen(L, 2) == numPaths, 2, "bad flows");
+	}
+	if (lua_isnoneornil(L, 3)) {
+		lua_settop(L, 2);
+		cellmap = newcellmap(L, 0);
+	} else {
+		cellmap = luaL_checkudata(L, 3, H3_CELLMAP);
+		lua_settop(L, 3);
+	}
+	operand.i = 0;
+	if (!flows) {
+		operand = cellmap_checkvalue(L, cellmap, 2);
+	}
+
+	/* adds the flow of each path to the consecutive directed edges of the path */
+	for (p = 0; p < numPaths; p++) {
+		if (flows) {
+			if (lua_rawgeti(L, 2, p + 1) != LUA_TNUMBER || (cellmap->integer
+					&& !lua_isinteger(L, -1))) {
+				return luaL_error(L, "bad flow");
+			}
+			if (cellmap->integer) {
+				operand.i = lua_tointeger(L, -1);
+			} else {
+				operand.n = lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		if (lua_rawgeti(L, 1, p + 1) != LUA_TTABLE) {
+			return luaL_error(L, "bad path");
+		}
+		len = lua_rawlen(L, -1);
+		previous = H3_NULL;
+		for (i = 0; i < len; i++) {
+			if (lua_rawgeti(L, -1, i + 1) != LUA_TNUMBER) {
+				return luaL_error(L, "bad cell");
+			}
+			cell = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			if (i > 0) {
+				check(L, cellsToDirectedEdge(previous, cell, &edge));
+				value = map_get(&cellmap->map, edge);
+				if (value == NULL) {
+					value = map_put(&cellmap->map, edge);
+					if (value == NULL) {
+						return luaL_error(L, "out of memory");
+					}
+					*value = operand;
+				} else {
+					cellmap_combine(cellmap, value, operand, 0);
+				}
+			}
+			previous = cell;
+		}
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
 static int h3_origintoedges (lua_State *L) {
 	int      i, j;
 	H3Index  origin, edges[6];
@@ -846,6 +3042,62 @@ static int h3_isvertex (lua_State *L) {
 	return 1;
 }
 
+static int h3_cellstomesh (lua_State *L) {
+	int        j, n;
+	size_t     len, i, numVertexes, numIndexes;
+	float     *coords;
+	uint32_t  *triangles, indexes[6];
+	LatLng     point;
+	h3_map    *map;
+	h3_value  *value;
+	H3Index   *cells, *vertexes, out[6];
+
+	memory_enter(L);
+	cells = checkcells(L, 1, &len);
+	map = newmap(L, len * 2);
+	vertexes = newbuffer(L, len * 6 * sizeof(H3Index));
+	triangles = newbuffer(L, len * 12 * sizeof(uint32_t));
+	numVertexes = 0;
+	numIndexes = 0;
+	for (i = 0; i < len; i++) {
+		check(L, cellToVertexes(cells[i], out));
+		n = 0;
+		for (j = 0; j < 6; j++) {
+			if (out[j] == H3_NULL) {
+				continue;
+			}
+			if ((value = map_get(map, out[j])) == NULL) {
+				if (numVertexes > UINT32_MAX) {
+					return luaL_error(L, "too many vertexes");
+				}
+				if ((value = map_put(map, out[j])) == NULL) {
+					return luaL_error(L, "out of memory");
+				}
+				value->i = numVertexes;
+				vertexes[numVertexes++] = out[j];
+			}
+			indexes[n++] = value->i;
+		}
+
+		/* triangle fan around the first vertex, in boundary order */
+		for (j = 1; j < n - 1; j++) {
+			triangles[numIndexes++] = indexes[0];
+			triangles[numIndexes++] = indexes[j];
+			triangles[numIndexes++] = indexes[j + 1];
+		}
+	}
+	coords = newbuffer(L, numVertexes * 2 * sizeof(float));
+	for (i = 0; i < numVertexes; i++) {
+		check(L, vertexToLatLng(vertexes[i], &point));
+		coords[2 * i] = radsToDegs(point.lng);
+		coords[2 * i + 1] = radsToDegs(point.lat);
+	}
+	lua_pushlstring(L, (const char *)coords, numVertexes * 2 * sizeof(float));
+	lua_pushlstring(L, (const char *)triangles, numIndexes * sizeof(uint32_t));
+	pushcells(L, vertexes, numVertexes);
+	return 3;
+}
+
 
 /*
  * miscellaneous
@@ -924,6 +3176,92 @@ static int h3_cellarea (lua_State *L)  {
 	return 1;
 }
 
+typedef struct cellsarea_arg {
+	const H3Index  *cells;
+	size_t          len;
+	int             unit;
+	int             chunks;
+	double          sums[H3_THREADS_MAX];
+	double          compensations[H3_THREADS_MAX];
+	int64_t         counts[H3_THREADS_MAX][16];
+	H3Error         errors[H3_THREADS_MAX];
+} cellsarea_arg;
+
+static void cellsarea_task (void *arg, int64_t begin, int64_t end) {
+	int             c, res;
+	size_t          i;
+	double          sum, compensation, area;
+	H3Error         error;
+	cellsarea_arg  *ca;
+
+	/* each item is a chunk of cells */
+	ca = arg;
+	for (c = begin; c < end; c++) {
+		sum = 0.0;
+		compensation = 0.0;
+		error = E_SUCCESS;
+		memset(ca->counts[c], 0, sizeof(ca->counts[c]));
+		for (i = ca->len * c / ca->chunks; i < ca->len * (c + 1) / ca->chunks; i++) {
+			switch (ca->unit) {
+			case 0:
+				error = cellAreaM2(ca->cells[i], &area);
+				break;
+
+			case 1:
+				error = cellAreaKm2(ca->cells[i], &area);
+				break;
+
+			default:
+				error = cellAreaRads2(ca->cells[i], &area);
+				break;
+			}
+			if (error != E_SUCCESS) {
+				break;
+			}
+			sumadd(&sum, &compensation, area);
+			res = getResolution(ca->cells[i]);
+			ca->counts[c][res]++;
+		}
+		ca->sums[c] = sum;
+		ca->compensations[c] = compensation;
+		ca->errors[c] = error;
+	}
+}
+
+static int h3_cellsarea (lua_State *L) {
+	int             c, res;
+	double          sum, compensation;
+	int64_t         count;
+	cellsarea_arg  *ca;
+
+	memory_enter(L);
+	ca = lua_newuserdata(L, sizeof(cellsarea_arg));
+	ca->cells = checkcells(L, 1, &ca->len);
+	ca->unit = luaL_checkoption(L, 2, "m", GEO_UNITS);
+	ca->chunks = optthreads(L, 3);
+	parallel(ca->chunks, ca->chunks, cellsarea_task, ca);
+	sum = 0.0;
+	compensation = 0.0;
+	for (c = 0; c < ca->chunks; c++) {
+		check(L, ca->errors[c]);
+		sumadd(&sum, &compensation, ca->sums[c]);
+		sumadd(&sum, &compensation, ca->compensations[c]);
+	}
+	lua_pushnumber(L, sum + compensation);
+	lua_createtable(L, 0, 0);
+	for (res = 0; res < 16; res++) {
+		count = 0;
+		for (c = 0; c < ca->chunks; c++) {
+			count += ca->counts[c][res];
+		}
+		if (count > 0) {
+			lua_pushinteger(L, count);
+			lua_rawseti(L, -2, res);
+		}
+	}
+	return 2;
+}
+
 static int h3_edgelength (lua_State *L)  {
 	int     unit;
 	double  length;
@@ -965,11 +3303,12 @@ static int h3_res0cells (lua_State *L) {
 	int64_t   num, i;
 	H3Index  *out;
 
+	memory_enter(L);
 	num = res0CellCount();  /* 122 */
 	if (num <= H3_STACK_MAX) {
 		out = alloca(num * sizeof(H3Index));
 	} else {
-		out = lua_newuserdata(L, num * sizeof(H3Index));
+		out = newbuffer(L, num * sizeof(H3Index));
 	}
 	check(L, getRes0Cells(out));
 	lua_createtable(L, num, 0);
@@ -985,12 +3324,13 @@ static int h3_pentagons (lua_State *L) {
 	int64_t   num, i;
 	H3Index  *out;
 
+	memory_enter(L);
 	res = luaL_checkinteger(L, 1);
 	num = pentagonCount();  /* 12 */
 	if (num <= H3_STACK_MAX) {
 		out = alloca(num * sizeof(H3Index));
 	} else {
-		out = lua_newuserdata(L, num * sizeof(H3Index));
+		out = newbuffer(L, num * sizeof(H3Index));
 	}
 	check(L, getPentagons(res, out));
 	lua_createtable(L, num, 0);
@@ -1031,14 +3371,1863 @@ static int h3_greatcircledistance (lua_State *L)  {
 	return 1;
 }
 
+static int h3_greatcircledistances (lua_State *L) {
+	int      unit;
+	size_t   len, i;
+	LatLng   a, b;
 
-/*
- * interface
- */
-
-int luaopen_h3 (lua_State *L) {
-	static const luaL_Reg FUNCTIONS[] = {
-		/* version */
+	a.lat = degsToRads(luaL_checknumber(L, 1));
+	a.lng = degsToRads(luaL_checknumber(L, 2));
+	luaL_checktype(L, 3, LUA_TTABLE);
+	unit = luaL_checkoption(L, 4, "m", GEO_UNITS);
+	len = lua_rawlen(L, 3);
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 3, i + 1) != LUA_TTABLE) {
+			return luaL_error(L, "bad point");
+		}
+		if (lua_rawgeti(L, -1, 1) != LUA_TNUMBER || lua_rawgeti(L, -2, 2) != LUA_TNUMBER) {
+			return luaL_error(L, "bad point");
+		}
+		b.lat = degsToRads(lua_tonumber(L, -2));
+		b.lng = degsToRads(lua_tonumber(L, -1));
+		lua_pop(L, 3);
+		lua_pushnumber(L, greatcircle(&a, &b, unit));
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+static int h3_celldistances (lua_State *L) {
+	int       unit;
+	size_t    len, i;
+	LatLng    a, b;
+	H3Index  *cells;
+
+	memory_enter(L);
+	a.lat = degsToRads(luaL_checknumber(L, 1));
+	a.lng = degsToRads(luaL_checknumber(L, 2));
+	cells = checkcells(L, 3, &len);
+	unit = luaL_checkoption(L, 4, "m", GEO_UNITS);
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		check(L, cellToLatLng(cells[i], &b));
+		lua_pushnumber(L, greatcircle(&a, &b, unit));
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+static int h3_cellswithinradius (lua_State *L) {
+	int        res, unit, k;
+	double     radius, meters, edge, distance;
+	LatLng     a, b;
+	int64_t    num, i, n;
+	H3Index    origin, *disk;
+
+	memory_enter(L);
+	a.lat = degsToRads(luaL_checknumber(L, 1));
+	a.lng = degsToRads(luaL_checknumber(L, 2));
+	radius = luaL_checknumber(L, 3);
+	luaL_argcheck(L, radius >= 0, 3, "bad radius");
+	res = luaL_checkinteger(L, 4);
+	unit = luaL_checkoption(L, 5, "m", GEO_UNITS);
+	switch (unit) {
+	case 0:
+		meters = radius;
+		break;
+
+	case 1:
+		meters = radius * 1000;
+		break;
+
+	default:
+		meters = radius * H3_EARTH_RADIUS_KM * 1000;
+		break;
+	}
+
+	/* neighboring centers are at least about one average edge apart; one ring covers the offset
+	 * of the point from the center of its cell */
+	check(L, latLngToCell(&a, res, &origin));
+	check(L, getHexagonEdgeLengthAvgM(res, &edge));
+	if (meters / edge + 1 > H3_GRID_RINGS_MAX) {
+		return luaL_error(L, "radius too large");
+	}
+	k = (int)ceil(meters / edge) + 1;
+	check(L, maxGridDiskSize(k, &num));
+	disk = newbuffer(L, num * sizeof(H3Index));
+	check(L, gridDisk(origin, k, disk));
+	lua_createtable(L, 0, 0);
+	lua_createtable(L, 0, 0);
+	n = 0;
+	for (i = 0; i < num; i++) {
+		if (disk[i] == H3_NULL) {
+			continue;
+		}
+		check(L, cellToLatLng(disk[i], &b));
+		distance = greatcircle(&a, &b, unit);
+		if (distance <= radius) {
+			n++;
+			lua_pushinteger(L, disk[i]);
+			lua_rawseti(L, -3, n);
+			lua_pushnumber(L, distance);
+			lua_rawseti(L, -2, n);
+		}
+	}
+	return 2;
+}
+
+
+/*
+ * memory
+ */
+
+static int h3_memorylimit (lua_State *L) {
+	lua_Integer  limit;
+	h3_memory   *memory;
+
+	memory = lua_touserdata(L, lua_upvalueindex(1));
+	lua_pushinteger(L, memory->limit);
+	if (!lua_isnoneornil(L, 1)) {
+		limit = luaL_checkinteger(L, 1);
+		luaL_argcheck(L, limit >= 0, 1, "bad limit");
+		memory->limit = limit;
+	}
+	return 1;
+}
+
+static int h3_memoryusage (lua_State *L) {
+	h3_memory  *memory;
+
+	memory = lua_touserdata(L, lua_upvalueindex(1));
+	lua_pushinteger(L, memory->used);
+	return 1;
+}
+
+
+/*
+ * point index
+ */
+
+#define POINTINDEX_KEY(id)  ((H3Index)(id) ^ 0x8000000000000000ULL)  /* id -> map key */
+
+static int64_t pointindex_checkid (lua_State *L, int index) {
+	lua_Integer  id;
+
+	/* the minimum integer maps to the empty key */
+	id = luaL_checkinteger(L, index);
+	luaL_argcheck(L, id != LUA_MININTEGER, index, "bad id");
+	return id;
+}
+
+static int64_t pointindex_alloc (h3_pointindex *index) {
+	size_t     size;
+	int64_t    p;
+	h3_point  *points;
+
+	if (index->free >= 0) {
+		p = index->free;
+		index->free = index->points[p].prev;
+		return p;
+	}
+	if (index->used == index->size) {
+		size = index->size > 0 ? index->size * 2 : H3_MAP_MIN;
+		if (size > SIZE_MAX / sizeof(h3_point)) {
+			return -1;
+		}
+		points = memory_realloc(index->points, size * sizeof(h3_point));
+		if (points == NULL) {
+			return -1;
+		}
+		index->points = points;
+		index->size = size;
+	}
+	return index->used++;
+}
+
+static void pointindex_release (h3_pointindex *index, int64_t p) {
+	index->points[p].cell = H3_NULL;
+	index->points[p].prev = index->free;
+	index->free = p;
+}
+
+static int pointindex_link (h3_pointindex *index, int64_t p) {
+	h3_point  *point;
+	h3_value  *head;
+
+	point = &index->points[p];
+	head = map_get(&index->cells, point->cell);
+	if (head == NULL) {
+		head = map_put(&index->cells, point->cell);
+		if (head == NULL) {
+			return -1;
+		}
+		point->next = -1;
+	} else {
+		point->next = head->i;
+		index->points[head->i].prev = p;
+	}
+	point->prev = -1;
+	head->i = p;
+	return 0;
+}
+
+static void pointindex_unlink (h3_pointindex *index, int64_t p) {
+	h3_point  *point;
+
+	point = &index->points[p];
+	if (point->prev >= 0) {
+		index->points[point->prev].next = point->next;
+	} else if (point->next >= 0) {
+		map_get(&index->cells, point->cell)->i = point->next;
+	} else {
+		map_remove(&index->cells, point->cell);
+	}
+	if (point->next >= 0) {
+		index->points[point->next].prev = point->prev;
+	}
+}
+
+static void pointindex_sift (h3_neighbor *heap, int64_t num, h3_neighbor entry) {
+	int64_t  i, child;
+
+	/* places the entry at the root of the max-heap and sifts it down */
+	i = 0;
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && heap[child + 1].distance > heap[child].distance) {
+			child++;
+		}
+		if (heap[child].distance <= entry.distance) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = entry;
+}
+
+static void pointindex_push (h3_neighbor *heap, int64_t *num, int64_t k, double distance,
+		int64_t id) {
+	int64_t      i;
+	h3_neighbor  entry;
+
+	/* max-heap on distance, holding the k nearest points seen so far */
+	entry.distance = distance;
+	entry.id = id;
+	if (*num < k) {
+		i = (*num)++;
+		while (i > 0 && heap[(i - 1) / 2].distance < distance) {
+			heap[i] = heap[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap[i] = entry;
+	} else if (distance < heap[0].distance) {
+		pointindex_sift(heap, k, entry);
+	}
+}
+
+static int h3_pointindex_ (lua_State *L) {
+	int             res;
+	h3_pointindex  *index;
+
+	memory_enter(L);
+	res = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, res >= 0 && res <= 15, 1, "bad resolution");
+	index = lua_newuserdata(L, sizeof(h3_pointindex));
+	memset(index, 0, sizeof(h3_pointindex));
+	index->res = res;
+	index->free = -1;
+	luaL_getmetatable(L, H3_POINTINDEX);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int pointindex_insert (lua_State *L) {
+	LatLng          g;
+	H3Index         cell;
+	int64_t         id, p;
+	h3_value       *value;
+	h3_point       *point;
+	h3_pointindex  *index;
+
+	memory_enter(L);
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	id = pointindex_checkid(L, 2);
+	g.lat = degsToRads(luaL_checknumber(L, 3));
+	g.lng = degsToRads(luaL_checknumber(L, 4));
+	check(L, latLngToCell(&g, index->res, &cell));
+	if (map_get(&index->ids, POINTINDEX_KEY(id)) != NULL) {
+		return luaL_error(L, "duplicate input");
+	}
+	p = pointindex_alloc(index);
+	if (p < 0) {
+		return luaL_error(L, "out of memory");
+	}
+	value = map_put(&index->ids, POINTINDEX_KEY(id));
+	if (value == NULL) {
+		pointindex_release(index, p);
+		return luaL_error(L, "out of memory");
+	}
+	value->i = p;
+	point = &index->points[p];
+	point->lat = g.lat;
+	point->lng = g.lng;
+	point->id = id;
+	point->cell = cell;
+	if (pointindex_link(index, p) != 0) {
+		map_remove(&index->ids, POINTINDEX_KEY(id));
+		pointindex_release(index, p);
+		return luaL_error(L, "out of memory");
+	}
+	return 0;
+}
+
+static int pointindex_move (lua_State *L) {
+	LatLng          g;
+	H3Index         cell, previous;
+	int64_t         id, p;
+	h3_value       *value;
+	h3_point       *point;
+	h3_pointindex  *index;
+
+	memory_enter(L);
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	id = pointindex_checkid(L, 2);
+	g.lat = degsToRads(luaL_checknumber(L, 3));
+	g.lng = degsToRads(luaL_checknumber(L, 4));
+	check(L, latLngToCell(&g, index->res, &cell));
+	value = map_get(&index->ids, POINTINDEX_KEY(id));
+	if (value == NULL) {
+		return luaL_error(L, "bad point");
+	}
+	p = value->i;
+	point = &index->points[p];
+	if (point->cell != cell) {
+		/* relinking into the previous cell cannot fail, as its entry is reusable */
+		previous = point->cell;
+		pointindex_unlink(index, p);
+		point->cell = cell;
+		if (pointindex_link(index, p) != 0) {
+			point->cell = previous;
+			pointindex_link(index, p);
+			return luaL_error(L, "out of memory");
+		}
+	}
+	point->lat = g.lat;
+	point->lng = g.lng;
+	return 0;
+}
+
+static int pointindex_remove (lua_State *L) {
+	int64_t         id, p;
+	h3_value       *value;
+	h3_pointindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	id = pointindex_checkid(L, 2);
+	value = map_get(&index->ids, POINTINDEX_KEY(id));
+	if (value == NULL) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	p = value->i;
+	pointindex_unlink(index, p);
+	map_remove(&index->ids, POINTINDEX_KEY(id));
+	pointindex_release(index, p);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static int pointindex_get (lua_State *L) {
+	int64_t         id;
+	h3_value       *value;
+	h3_point       *point;
+	h3_pointindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	id = pointindex_checkid(L, 2);
+	value = map_get(&index->ids, POINTINDEX_KEY(id));
+	if (value == NULL) {
+		return 0;
+	}
+	point = &index->points[value->i];
+	lua_pushnumber(L, radsToDegs(point->lat));
+	lua_pushnumber(L, radsToDegs(point->lng));
+	return 2;
+}
+
+static int pointindex_knn (lua_State *L) {
+	int             r, j, scan;
+	int            *distances;
+	double          maxdist, edge, length, distance;
+	size_t          seen, visited;
+	LatLng          g, pg;
+	H3Index         origin, edges[6], *ring, *disk;
+	int64_t         k, p, num, size, n, i;
+	h3_value       *head;
+	h3_point       *point;
+	h3_neighbor    *heap, top;
+	h3_pointindex  *index;
+
+	memory_enter(L);
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	g.lat = degsToRads(luaL_checknumber(L, 2));
+	g.lng = degsToRads(luaL_checknumber(L, 3));
+	k = luaL_checkinteger(L, 4);
+	luaL_argcheck(L, k >= 1, 4, "bad k");
+	maxdist = luaL_optnumber(L, 5, HUGE_VAL);
+	check(L, latLngToCell(&g, index->res, &origin));
+	if (k > (int64_t)index->ids.count) {
+		k = index->ids.count;
+	}
+	heap = newbuffer(L, (k > 0 ? k : 1) * sizeof(h3_neighbor));
+
+	/* points in a cell at grid distance r are at least (r - 1) edge lengths away; the
+	 * shortest edge of the origin is scaled to allow for distortion in nearby cells */
+	check(L, originToDirectedEdges(origin, edges));
+	edge = HUGE_VAL;
+	for (j = 0; j < 6; j++) {
+		if (edges[j] != H3_NULL) {
+			check(L, edgeLengthM(edges[j], &length));
+			if (length < edge) {
+				edge = length;
+			}
+		}
+	}
+	edge *= 0.75;
+
+	/* expand ring by ring, until the rings have more cells than the index has points */
+	num = 0;
+	seen = 0;
+	visited = 0;
+	scan = 0;
+	size = H3_STACK_MAX;
+	ring = newbuffer(L, size * sizeof(H3Index));
+	for (r = 0; seen < index->ids.count; r++) {
+		if ((r - 1) * edge > maxdist || (num == k && (r - 1) * edge > heap[0].distance)) {
+			break;
+		}
+		if (visited > index->ids.count || r > H3_GRID_RINGS_MAX) {
+			scan = 1;
+			break;
+		}
+		if (r == 0) {
+			ring[0] = origin;
+			n = 1;
+		} else {
+			n = 6 * (int64_t)r;
+			if (n > size) {
+				size = n * 2;
+				lua_pop(L, 1);
+				ring = newbuffer(L, size * sizeof(H3Index));
+			}
+			if (gridRingUnsafe(origin, r, ring) != E_SUCCESS) {
+				/* pentagonal distortion; take the ring from the safe disk */
+				check(L, maxGridDiskSize(r, &i));
+				disk = newbuffer(L, i * (sizeof(H3Index) + sizeof(int)));
+				distances = (int *)(disk + i);
+				memset(disk, 0, i * sizeof(H3Index));
+				check(L, gridDiskDistances(origin, r, disk, distances));
+				n = 0;
+				for (p = 0; p < i; p++) {
+					if (disk[p] != H3_NULL && distances[p] == r && n < size) {
+						ring[n++] = disk[p];
+					}
+				}
+				lua_pop(L, 1);
+			}
+		}
+		for (i = 0; i < n; i++) {
+			if (ring[i] == H3_NULL || (head = map_get(&index->cells, ring[i])) == NULL) {
+				continue;
+			}
+			for (p = head->i; p >= 0; p = point->next) {
+				point = &index->points[p];
+				pg.lat = point->lat;
+				pg.lng = point->lng;
+				distance = greatCircleDistanceM(&g, &pg);
+				if (distance <= maxdist) {
+					pointindex_push(heap, &num, k, distance, point->id);
+				}
+				seen++;
+			}
+		}
+		visited += n;
+	}
+
+	/* sparse points; scan them linearly instead */
+	if (scan) {
+		num = 0;
+		for (p = 0; p < (int64_t)index->used; p++) {
+			point = &index->points[p];
+			if (point->cell == H3_NULL) {
+				continue;
+			}
+			pg.lat = point->lat;
+			pg.lng = point->lng;
+			distance = greatCircleDistanceM(&g, &pg);
+			if (distance <= maxdist) {
+				pointindex_push(heap, &num, k, distance, point->id);
+			}
+		}
+	}
+
+	/* sort ascending */
+	for (i = num - 1; i > 0; i--) {
+		top = heap[0];
+		pointindex_sift(heap, i, heap[i]);
+		heap[i] = top;
+	}
+	lua_createtable(L, num, 0);
+	lua_createtable(L, num, 0);
+	for (i = 0; i < num; i++) {
+		lua_pushinteger(L, heap[i].id);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushnumber(L, heap[i].distance);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+
+static int pointindex_len (lua_State *L) {
+	h3_pointindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	lua_pushinteger(L, index->ids.count);
+	return 1;
+}
+
+static int pointindex_gc (lua_State *L) {
+	h3_pointindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_POINTINDEX);
+	memory_free(index->points);
+	map_free(&index->ids);
+	map_free(&index->cells);
+	return 0;
+}
+
+
+/*
+ * cell map
+ */
+
+#define CELLMAP_SET  -1  /* update operation: assign */
+
+static h3_cellmap *newcellmap (lua_State *L, int integer) {
+	h3_cellmap  *cellmap;
+
+	cellmap = lua_newuserdata(L, sizeof(h3_cellmap));
+	memset(cellmap, 0, sizeof(h3_cellmap));
+	cellmap->integer = integer;
+	luaL_getmetatable(L, H3_CELLMAP);
+	lua_setmetatable(L, -2);
+	return cellmap;
+}
+
+static void cellmap_pushvalue (lua_State *L, const h3_cellmap *cellmap, const h3_value *value) {
+	if (cellmap->integer) {
+		lua_pushinteger(L, value->i);
+	} else {
+		lua_pushnumber(L, value->n);
+	}
+}
+
+static h3_value cellmap_checkvalue (lua_State *L, const h3_cellmap *cellmap, int index) {
+	h3_value  value;
+
+	if (cellmap->integer) {
+		value.i = luaL_checkinteger(L, index);
+	} else {
+		value.n = luaL_checknumber(L, index);
+	}
+	return value;
+}
+
+static void cellmap_combine (const h3_cellmap *cellmap, h3_value *value, h3_value operand,
+		int op) {
+	switch (op) {
+	case 0:
+		if (cellmap->integer) {
+			value->i += operand.i;
+		} else {
+			value->n += operand.n;
+		}
+		break;
+
+	case 1:
+		if (cellmap->integer ? operand.i < value->i : operand.n < value->n) {
+			*value = operand;
+		}
+		break;
+
+	case 2:
+		if (cellmap->integer ? operand.i > value->i : operand.n > value->n) {
+			*value = operand;
+		}
+		break;
+
+	default:
+		*value = operand;
+		break;
+	}
+}
+
+static int cellmap_update (lua_State *L, int op) {
+	int          values;
+	size_t       len, i;
+	H3Index      cell;
+	h3_value     operand, *value;
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	values = lua_type(L, 3) == LUA_TTABLE;
+	operand.i = 0;
+	if (!values) {
+		operand = cellmap_checkvalue(L, cellmap, 3);
+	}
+	len = lua_rawlen(L, 2);
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 2, i + 1) != LUA_TNUMBER || (cell = lua_tointeger(L, -1))
+				== H3_NULL) {
+			return luaL_error(L, "bad cell");
+		}
+		if (values) {
+			if (lua_rawgeti(L, 3, i + 1) != LUA_TNUMBER || (cellmap->integer
+					&& !lua_isinteger(L, -1))) {
+				return luaL_error(L, "bad value");
+			}
+			if (cellmap->integer) {
+				operand.i = lua_tointeger(L, -1);
+			} else {
+				operand.n = lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+		value = map_get(&cellmap->map, cell);
+		if (value == NULL) {
+			value = map_put(&cellmap->map, cell);
+			if (value == NULL) {
+				return luaL_error(L, "out of memory");
+			}
+			*value = operand;
+		} else {
+			cellmap_combine(cellmap, value, operand, op);
+		}
+	}
+	return 0;
+}
+
+static int h3_cellmap_ (lua_State *L) {
+	memory_enter(L);
+	newcellmap(L, luaL_checkoption(L, 1, "number", CELLMAP_TYPES));
+	return 1;
+}
+
+static int cellmap_get (lua_State *L) {
+	size_t       len, i;
+	h3_value    *value;
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	if (lua_isnoneornil(L, 3)) {
+		lua_settop(L, 2);
+		lua_pushinteger(L, 0);
+	} else {
+		cellmap_checkvalue(L, cellmap, 3);
+		lua_settop(L, 3);
+	}
+	len = lua_rawlen(L, 2);
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 2, i + 1) != LUA_TNUMBER) {
+			return luaL_error(L, "bad cell");
+		}
+		value = map_get(&cellmap->map, lua_tointeger(L, -1));
+		lua_pop(L, 1);
+		if (value != NULL) {
+			cellmap_pushvalue(L, cellmap, value);
+		} else {
+			lua_pushvalue(L, 3);
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+static int cellmap_set (lua_State *L) {
+	memory_enter(L);
+	return cellmap_update(L, CELLMAP_SET);
+}
+
+static int cellmap_add (lua_State *L) {
+	memory_enter(L);
+	return cellmap_update(L, 0);
+}
+
+static int cellmap_cells (lua_State *L) {
+	size_t       i;
+	int64_t      num;
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	lua_createtable(L, cellmap->map.count, 0);
+	lua_createtable(L, cellmap->map.count, 0);
+	num = 0;
+	for (i = 0; i < cellmap->map.size; i++) {
+		if (cellmap->map.keys[i] != H3_NULL) {
+			num++;
+			lua_pushinteger(L, cellmap->map.keys[i]);
+			lua_rawseti(L, -3, num);
+			cellmap_pushvalue(L, cellmap, &cellmap->map.values[i]);
+			lua_rawseti(L, -2, num);
+		}
+	}
+	return 2;
+}
+
+static int cellmap_merge (lua_State *L) {
+	int          res, op;
+	size_t       i;
+	H3Index      parent;
+	h3_value    *value;
+	h3_cellmap  *cellmap, *merged;
+
+	memory_enter(L);
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	res = luaL_checkinteger(L, 2);
+	op = luaL_checkoption(L, 3, "sum", CELLMAP_OPS);
+	merged = newcellmap(L, cellmap->integer);
+	if (map_init(&merged->map, cellmap->map.count) != 0) {
+		return luaL_error(L, "out of memory");
+	}
+	for (i = 0; i < cellmap->map.size; i++) {
+		if (cellmap->map.keys[i] == H3_NULL) {
+			continue;
+		}
+		check(L, cellToParent(cellmap->map.keys[i], res, &parent));
+		value = map_get(&merged->map, parent);
+		if (value == NULL) {
+			value = map_put(&merged->map, parent);
+			if (value == NULL) {
+				return luaL_error(L, "out of memory");
+			}
+			*value = cellmap->map.values[i];
+		} else {
+			cellmap_combine(merged, value, cellmap->map.values[i], op);
+		}
+	}
+	return 1;
+}
+
+static int cellmap_index (lua_State *L) {
+	h3_value    *value;
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));  /* methods */
+		return 1;
+	}
+	value = map_get(&cellmap->map, lua_tointeger(L, 2));
+	if (value == NULL) {
+		return 0;
+	}
+	cellmap_pushvalue(L, cellmap, value);
+	return 1;
+}
+
+static int cellmap_newindex (lua_State *L) {
+	H3Index      cell;
+	h3_value     operand, *value;
+	h3_cellmap  *cellmap;
+
+	memory_enter(L);
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	cell = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, cell != H3_NULL, 2, "bad cell");
+	if (lua_isnil(L, 3)) {
+		map_remove(&cellmap->map, cell);
+		return 0;
+	}
+	operand = cellmap_checkvalue(L, cellmap, 3);
+	value = map_put(&cellmap->map, cell);
+	if (value == NULL) {
+		return luaL_error(L, "out of memory");
+	}
+	*value = operand;
+	return 0;
+}
+
+static int cellmap_next (lua_State *L) {
+	size_t       i;
+	h3_value    *value;
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	if (lua_isnoneornil(L, 2)) {
+		i = 0;
+	} else {
+		value = map_get(&cellmap->map, luaL_checkinteger(L, 2));
+		if (value == NULL) {
+			return luaL_error(L, "bad cell");
+		}
+		i = value - cellmap->map.values + 1;
+	}
+	for (; i < cellmap->map.size; i++) {
+		if (cellmap->map.keys[i] != H3_NULL) {
+			lua_pushinteger(L, cellmap->map.keys[i]);
+			cellmap_pushvalue(L, cellmap, &cellmap->map.values[i]);
+			return 2;
+		}
+	}
+	lua_pushnil(L);
+	return 1;
+}
+
+static int cellmap_pairs (lua_State *L) {
+	luaL_checkudata(L, 1, H3_CELLMAP);
+	lua_pushcfunction(L, cellmap_next);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+static int cellmap_len (lua_State *L) {
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	lua_pushinteger(L, cellmap->map.count);
+	return 1;
+}
+
+static int cellmap_gc (lua_State *L) {
+	h3_cellmap  *cellmap;
+
+	cellmap = luaL_checkudata(L, 1, H3_CELLMAP);
+	map_free(&cellmap->map);
+	return 0;
+}
+
+
+/*
+ * cell index
+ */
+
+static int cellindex_open (lua_State *L, const char *path, h3_cellindex *index) {
+	int                  fd;
+	void                *base;
+	size_t               size, entry;
+	struct stat          st;
+	h3_cellindexheader  *header;
+
+	/* maps the file read-only; the mapping remains valid after the file is replaced */
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return luaL_error(L, "cannot open %s: %s", path, strerror(errno));
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return luaL_error(L, "cannot stat %s: %s", path, strerror(errno));
+	}
+	size = st.st_size;
+	if (size < sizeof(h3_cellindexheader)) {
+		close(fd);
+		return luaL_error(L, "bad cell index");
+	}
+	base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return luaL_error(L, "cannot map %s: %s", path, strerror(errno));
+	}
+	header = base;
+	entry = header->flags & H3_CELLINDEX_IDS ? sizeof(H3Index) + sizeof(int64_t)
+			: sizeof(H3Index);
+	if (memcmp(header->magic, H3_CELLINDEX_MAGIC, sizeof(header->magic)) != 0
+			|| header->count > (size - sizeof(h3_cellindexheader)) / entry
+			|| size != sizeof(h3_cellindexheader) + header->count * entry) {
+		munmap(base, size);
+		return luaL_error(L, "bad cell index");
+	}
+	index->base = base;
+	index->size = size;
+	index->cells = (const H3Index *)(header + 1);
+	index->ids = header->flags & H3_CELLINDEX_IDS ? (const int64_t *)(index->cells
+			+ header->count) : NULL;
+	index->count = header->count;
+	index->resolutions = header->resolutions;
+	index->dev = st.st_dev;
+	index->ino = st.st_ino;
+	index->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+static void cellindex_close (h3_cellindex *index) {
+	if (index->base != NULL) {
+		munmap(index->base, index->size);
+		index->base = NULL;
+	}
+}
+
+static int64_t cellindex_find (lua_State *L, const h3_cellindex *index, H3Index cell) {
+	int       res;
+	H3Index   parent;
+	uint64_t  low, high, mid;
+
+	/* searches the cell and its ancestors at the resolutions present in the index */
+	for (res = getResolution(cell); res >= 0; res--) {
+		if ((index->resolutions & (1 << res)) == 0) {
+			continue;
+		}
+		check(L, cellToParent(cell, res, &parent));
+		low = 0;
+		high = index->count;
+		while (low < high) {
+			mid = low + (high - low) / 2;
+			if (index->cells[mid] < parent) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		if (low < index->count && index->cells[low] == parent) {
+			return low;
+		}
+	}
+	return -1;
+}
+
+static int cellindex_write (FILE *f, const h3_cellindexheader *header,
+		const h3_cellentry *entries, int ids) {
+	uint64_t  i;
+
+	if (fwrite(header, sizeof(h3_cellindexheader), 1, f) != 1) {
+		return -1;
+	}
+	for (i = 0; i < header->count; i++) {
+		if (fwrite(&entries[i].cell, sizeof(H3Index), 1, f) != 1) {
+			return -1;
+		}
+	}
+	for (i = 0; ids && i < header->count; i++) {
+		if (fwrite(&entries[i].id, sizeof(int64_t), 1, f) != 1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int h3_writecellindex (lua_State *L) {
+	int                  ids, error;
+	FILE                *f;
+	size_t               len, i;
+	const char          *path, *tmp;
+	h3_cellentry        *entries;
+	h3_cellindexheader   header;
+
+	memory_enter(L);
+	path = luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	ids = !lua_isnoneornil(L, 3);
+	if (ids) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+	}
+	len = lua_rawlen(L, 2);
+	entries = newbuffer(L, len * sizeof(h3_cellentry));
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, H3_CELLINDEX_MAGIC, sizeof(header.magic));
+	header.count = len;
+	header.flags = ids ? H3_CELLINDEX_IDS : 0;
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 2, i + 1) != LUA_TNUMBER) {
+			return luaL_error(L, "bad cell");
+		}
+		entries[i].cell = lua_tointeger(L, -1);
+		if (!isValidCell(entries[i].cell)) {
+			return luaL_error(L, "bad cell");
+		}
+		header.resolutions |= 1 << getResolution(entries[i].cell);
+		if (ids) {
+			if (lua_rawgeti(L, 3, i + 1) != LUA_TNUMBER || !lua_isinteger(L, -1)) {
+				return luaL_error(L, "bad id");
+			}
+			entries[i].id = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+	qsort(entries, len, sizeof(h3_cellentry), comparecells);  /* cell is the first member */
+	for (i = 1; i < len; i++) {
+		if (entries[i].cell == entries[i - 1].cell) {
+			return luaL_error(L, "duplicate input");
+		}
+	}
+
+	/* write a temporary file and rename it over the index, replacing it atomically */
+	tmp = lua_pushfstring(L, "%s.%d.tmp", path, (int)getpid());
+	f = fopen(tmp, "wb");
+	if (f == NULL) {
+		return luaL_error(L, "cannot open %s: %s", tmp, strerror(errno));
+	}
+	if (cellindex_write(f, &header, entries, ids) != 0 || fflush(f) != 0
+			|| fsync(fileno(f)) != 0) {
+		error = errno;
+		fclose(f);
+		unlink(tmp);
+		return luaL_error(L, "cannot write %s: %s", tmp, strerror(error));
+	}
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		error = errno;
+		unlink(tmp);
+		return luaL_error(L, "cannot write %s: %s", path, strerror(error));
+	}
+	return 0;
+}
+
+static int h3_opencellindex (lua_State *L) {
+	const char    *path;
+	h3_cellindex  *index;
+
+	memory_enter(L);
+	path = luaL_checkstring(L, 1);
+	index = lua_newuserdata(L, sizeof(h3_cellindex));
+	memset(index, 0, sizeof(h3_cellindex));
+	luaL_getmetatable(L, H3_CELLINDEX);
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+	cellindex_open(L, path, index);
+	return 1;
+}
+
+static int cellindex_contains (lua_State *L) {
+	H3Index        cell;
+	h3_cellindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_CELLINDEX);
+	cell = luaL_checkinteger(L, 2);
+	lua_pushboolean(L, cellindex_find(L, index, cell) >= 0);
+	return 1;
+}
+
+static int cellindex_lookup (lua_State *L) {
+	H3Index        cell;
+	int64_t        pos;
+	h3_cellindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_CELLINDEX);
+	cell = luaL_checkinteger(L, 2);
+	pos = cellindex_find(L, index, cell);
+	if (pos < 0) {
+		return 0;
+	}
+	lua_pushinteger(L, index->ids != NULL ? index->ids[pos] : pos + 1);
+	lua_pushinteger(L, index->cells[pos]);
+	return 2;
+}
+
+static int cellindex_reload (lua_State *L) {
+	const char    *path;
+	struct stat    st;
+	h3_cellindex  *index, generation;
+
+	index = luaL_checkudata(L, 1, H3_CELLINDEX);
+	lua_getuservalue(L, 1);
+	path = lua_tostring(L, -1);
+	if (stat(path, &st) != 0) {
+		return luaL_error(L, "cannot stat %s: %s", path, strerror(errno));
+	}
+	if (index->base != NULL && (uint64_t)st.st_dev == index->dev
+			&& (uint64_t)st.st_ino == index->ino && (int64_t)st.st_mtim.tv_sec
+			* 1000000000 + st.st_mtim.tv_nsec == index->mtime) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	memset(&generation, 0, sizeof(generation));
+	cellindex_open(L, path, &generation);
+	cellindex_close(index);
+	*index = generation;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static int cellindex_len (lua_State *L) {
+	h3_cellindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_CELLINDEX);
+	lua_pushinteger(L, index->count);
+	return 1;
+}
+
+static int cellindex_gc (lua_State *L) {
+	h3_cellindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_CELLINDEX);
+	cellindex_close(index);
+	return 0;
+}
+
+
+/*
+ * polygon index
+ */
+
+#define POLYGONINDEX_LNG(lng, transmeridian)  /* shifts negative longitudes east */ \
+		((transmeridian) && (lng) < 0 ? (lng) + 2 * M_PI : (lng))
+
+static int loop_contains (const GeoLoop *loop, const LatLng *g) {
+	int      i, j, inside, transmeridian;
+	double   lng, alng, blng;
+	LatLng  *a, *b;
+
+	/* loops with an edge spanning more than half the globe cross the antimeridian; their
+	 * negative longitudes are shifted east */
+	transmeridian = 0;
+	for (i = 0, j = loop->numVerts - 1; i < loop->numVerts; j = i++) {
+		if (fabs(loop->verts[i].lng - loop->verts[j].lng) > M_PI) {
+			transmeridian = 1;
+			break;
+		}
+	}
+
+	/* even-odd rule with a ray in the direction of increasing longitude */
+	lng = POLYGONINDEX_LNG(g->lng, transmeridian);
+	inside = 0;
+	for (i = 0, j = loop->numVerts - 1; i < loop->numVerts; j = i++) {
+		a = &loop->verts[i];
+		b = &loop->verts[j];
+		alng = POLYGONINDEX_LNG(a->lng, transmeridian);
+		blng = POLYGONINDEX_LNG(b->lng, transmeridian);
+		if ((a->lat > g->lat) != (b->lat > g->lat) && lng < (blng - alng)
+				* (g->lat - a->lat) / (b->lat - a->lat) + alng) {
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+static int polygon_contains (const GeoPolygon *polygon, const LatLng *g) {
+	int  i;
+
+	if (!loop_contains(&polygon->geoloop, g)) {
+		return 0;
+	}
+	for (i = 0; i < polygon->numHoles; i++) {
+		if (loop_contains(&polygon->holes[i], g)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int comparepolygons (const void *a, const void *b) {
+	const h3_cellentry  *x, *y;
+
+	x = a;
+	y = b;
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static int polygonindex_candidate (h3_polygonindex *index, H3Index cell, int64_t polygon) {
+	size_t         size;
+	int64_t        c;
+	h3_value      *head;
+	h3_candidate  *candidates;
+
+	/* adds the polygon to the exact tests of a cell straddling polygon boundaries */
+	head = map_get(&index->boundary, cell);
+	for (c = head != NULL ? head->i : -1; c >= 0; c = index->candidates[c].next) {
+		if (index->candidates[c].polygon == polygon) {
+			return 0;
+		}
+	}
+	if (index->used == index->size) {
+		size = index->size > 0 ? index->size * 2 : H3_MAP_MIN;
+		if (size > SIZE_MAX / sizeof(h3_candidate)) {
+			return -1;
+		}
+		candidates = memory_realloc(index->candidates, size * sizeof(h3_candidate));
+		if (candidates == NULL) {
+			return -1;
+		}
+		index->candidates = candidates;
+		index->size = size;
+	}
+	if (head == NULL) {
+		head = map_put(&index->boundary, cell);
+		if (head == NULL) {
+			return -1;
+		}
+		head->i = -1;
+	}
+	c = index->used++;
+	index->candidates[c].polygon = polygon;
+	index->candidates[c].next = head->i;
+	head->i = c;
+	return 0;
+}
+
+static void polygonindex_cover (lua_State *L, h3_polygonindex *index, int64_t polygon,
+		h3_map *owners) {
+	int          top, i, k, interior;
+	int64_t      num, j;
+	h3_map      *cover;
+	H3Index     *cells, disk[7];
+	h3_value    *owner;
+	GeoPolygon  *p;
+
+	/* cells whose neighbors are all in the cover are interior; the others and their
+	 * neighbors outside the cover straddle the boundary, as do the cells along the edges */
+	top = lua_gettop(L);
+	p = &index->polygons[polygon];
+	check(L, maxPolygonToCellsSize(p, index->res, 0, &num));
+	cells = newbuffer(L, num * sizeof(H3Index));
+	memset(cells, 0, num * sizeof(H3Index));
+	check(L, polygonToCells(p, index->res, 0, cells));
+	cover = newmap(L, num);
+	for (j = 0; j < num; j++) {
+		if (cells[j] != H3_NULL && map_put(cover, cells[j]) == NULL) {
+			luaL_error(L, "out of memory");
+		}
+	}
+	for (j = 0; j < num; j++) {
+		if (cells[j] == H3_NULL) {
+			continue;
+		}
+		memset(disk, 0, sizeof(disk));
+		check(L, gridDisk(cells[j], 1, disk));
+		interior = 1;
+		for (k = 0; k < 7; k++) {
+			if (disk[k] != H3_NULL && map_get(cover, disk[k]) == NULL) {
+				interior = 0;
+				if (polygonindex_candidate(index, disk[k], polygon) != 0) {
+					luaL_error(L, "out of memory");
+				}
+			}
+		}
+		if (!interior) {
+			if (polygonindex_candidate(index, cells[j], polygon) != 0) {
+				luaL_error(L, "out of memory");
+			}
+			continue;
+		}
+		owner = map_get(owners, cells[j]);
+		if (owner == NULL) {
+			owner = map_put(owners, cells[j]);
+			if (owner == NULL) {
+				luaL_error(L, "out of memory");
+			}
+			owner->i = polygon;
+		} else {
+			/* overlapping polygons */
+			if (polygonindex_candidate(index, cells[j], owner->i) != 0
+					|| polygonindex_candidate(index, cells[j], polygon) != 0) {
+				luaL_error(L, "out of memory");
+			}
+		}
+	}
+	for (i = -1; i < p->numHoles; i++) {
+		polygonindex_trace(L, index, polygon, i < 0 ? &p->geoloop : &p->holes[i]);
+	}
+	lua_settop(L, top);
+}
+
+static void polygonindex_trace (lua_State *L, h3_polygonindex *index, int64_t polygon,
+		const GeoLoop *loop) {
+	int            i, k;
+	double         edge, dlng;
+	int64_t        steps, s;
+	LatLng         sample;
+	H3Index        cell, disk[7];
+	const LatLng  *a, *b;
+
+	/* the cells the edges pass through straddle the boundary, even if the polygon is too
+	 * narrow to contain cell centers; the edges are sampled at half the average edge length,
+	 * and the neighbors of the sampled cells cover the cells clipped between samples */
+	check(L, getHexagonEdgeLengthAvgKm(index->res, &edge));
+	edge /= 2 * H3_EARTH_RADIUS_KM;
+	for (i = 0; i < loop->numVerts; i++) {
+		a = &loop->verts[i];
+		b = &loop->verts[(i + 1) % loop->numVerts];
+		dlng = b->lng - a->lng;
+		if (dlng > M_PI) {
+			dlng -= 2 * M_PI;
+		} else if (dlng < -M_PI) {
+			dlng += 2 * M_PI;
+		}
+		steps = ceil((fabs(b->lat - a->lat) + fabs(dlng)) / edge);
+		if (steps < 1) {
+			steps = 1;
+		}
+		for (s = 0; s < steps; s++) {
+			sample.lat = a->lat + (b->lat - a->lat) * s / steps;
+			sample.lng = a->lng + dlng * s / steps;
+			if (sample.lng > M_PI) {
+				sample.lng -= 2 * M_PI;
+			} else if (sample.lng < -M_PI) {
+				sample.lng += 2 * M_PI;
+			}
+			check(L, latLngToCell(&sample, index->res, &cell));
+			memset(disk, 0, sizeof(disk));
+			check(L, gridDisk(cell, 1, disk));
+			for (k = 0; k < 7; k++) {
+				if (disk[k] != H3_NULL && polygonindex_candidate(index, disk[k], polygon)
+						!= 0) {
+					luaL_error(L, "out of memory");
+				}
+			}
+		}
+	}
+}
+
+static void polygonindex_compact (lua_State *L, h3_polygonindex *index, h3_map *owners) {
+	int            top;
+	size_t         i, n, begin, end, num, j;
+	H3Index       *cells;
+	h3_value      *value;
+	h3_cellentry  *entries;
+
+	/* interior cells that also straddle the boundary of another polygon are tested */
+	top = lua_gettop(L);
+	entries = newbuffer(L, owners->count * sizeof(h3_cellentry));
+	n = 0;
+	for (i = 0; i < owners->size; i++) {
+		if (owners->keys[i] == H3_NULL) {
+			continue;
+		}
+		if (map_get(&index->boundary, owners->keys[i]) != NULL) {
+			if (polygonindex_candidate(index, owners->keys[i], owners->values[i].i) != 0) {
+				luaL_error(L, "out of memory");
+			}
+			continue;
+		}
+		entries[n].cell = owners->keys[i];
+		entries[n].id = owners->values[i].i;
+		n++;
+	}
+
+	/* compact the interior cells of each polygon */
+	qsort(entries, n, sizeof(h3_cellentry), comparepolygons);
+	cells = newbuffer(L, n * sizeof(H3Index));
+	for (begin = 0; begin < n; begin = end) {
+		for (end = begin; end < n && entries[end].id == entries[begin].id; end++) {
+			cells[end - begin] = entries[end].cell;
+		}
+		num = compactcells(L, cells, end - begin, 1);
+		for (j = 0; j < num; j++) {
+			value = map_put(&index->interior, cells[j]);
+			if (value == NULL) {
+				luaL_error(L, "out of memory");
+			}
+			value->i = entries[begin].id;
+			index->resolutions |= 1 << getResolution(cells[j]);
+		}
+	}
+	lua_settop(L, top);
+}
+
+static int64_t polygonindex_find (lua_State *L, const h3_polygonindex *index, const LatLng *g) {
+	int        res;
+	H3Index    cell, parent;
+	int64_t    c, polygon;
+	h3_value  *value;
+
+	check(L, latLngToCell(g, index->res, &cell));
+	value = map_get(&index->boundary, cell);
+	if (value != NULL) {
+		/* exact tests; the lowest matching polygon wins */
+		polygon = -1;
+		for (c = value->i; c >= 0; c = index->candidates[c].next) {
+			if ((polygon < 0 || index->candidates[c].polygon < polygon)
+					&& polygon_contains(&index->polygons[index->candidates[c].polygon], g)) {
+				polygon = index->candidates[c].polygon;
+			}
+		}
+		return polygon;
+	}
+	for (res = index->res; res >= 0; res--) {
+		if ((index->resolutions & (1 << res)) == 0) {
+			continue;
+		}
+		check(L, cellToParent(cell, res, &parent));
+		value = map_get(&index->interior, parent);
+		if (value != NULL) {
+			return value->i;
+		}
+	}
+	return -1;
+}
+
+static int h3_polygonindex_ (lua_State *L) {
+	int               res;
+	size_t            len, i;
+	h3_map           *owners;
+	h3_polygonindex  *index;
+
+	memory_enter(L);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	res = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, res >= 0 && res <= 15, 3, "bad resolution");
+	len = lua_rawlen(L, 1);
+	luaL_argcheck(L, lua_rawlen(L, 2) == len, 2, "bad ids");
+	lua_settop(L, 3);
+	index = lua_newuserdata(L, sizeof(h3_polygonindex));
+	memset(index, 0, sizeof(h3_polygonindex));
+	index->res = res;
+	luaL_getmetatable(L, H3_POLYGONINDEX);
+	lua_setmetatable(L, -2);
+	index->polygons = memory_calloc(len > 0 ? len : 1, sizeof(GeoPolygon));
+	index->ids = memory_alloc((len > 0 ? len : 1) * sizeof(int64_t));
+	if (index->polygons == NULL || index->ids == NULL) {
+		return luaL_error(L, "out of memory");
+	}
+	index->count = len;
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 2, i + 1) != LUA_TNUMBER || !lua_isinteger(L, -1)
+				|| lua_tointeger(L, -1) == LUA_MININTEGER) {
+			return luaL_error(L, "bad id");
+		}
+		index->ids[i] = lua_tointeger(L, -1);
+		if (lua_rawgeti(L, 1, i + 1) != LUA_TTABLE) {
+			return luaL_error(L, "bad polygon");
+		}
+		geopolygon(L, 6, &index->polygons[i]);
+		lua_pop(L, 2);
+	}
+
+	/* rasterize */
+	owners = newmap(L, 0);
+	for (i = 0; i < len; i++) {
+		polygonindex_cover(L, index, i, owners);
+	}
+	polygonindex_compact(L, index, owners);
+	lua_settop(L, 4);
+	return 1;
+}
+
+static int polygonindex_label (lua_State *L) {
+	int               format;
+	size_t            len, i;
+	LatLng            g;
+	int64_t           polygon, *packed;
+	const char       *points;
+	h3_polygonindex  *index;
+
+	memory_enter(L);
+	index = luaL_checkudata(L, 1, H3_POLYGONINDEX);
+	len = checkpoints(L, 2, &points);
+	format = luaL_checkoption(L, 3, "list", MATRIX_FORMATS);
+	if (format == 1) {
+		/* native 64-bit integers; the minimum integer marks unlabeled points */
+		packed = newbuffer(L, len * sizeof(int64_t));
+		for (i = 0; i < len; i++) {
+			getpoint(L, 2, points, i, &g);
+			polygon = polygonindex_find(L, index, &g);
+			packed[i] = polygon >= 0 ? index->ids[polygon] : LUA_MININTEGER;
+		}
+		lua_pushlstring(L, (const char *)packed, len * sizeof(int64_t));
+		return 1;
+	}
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		getpoint(L, 2, points, i, &g);
+		polygon = polygonindex_find(L, index, &g);
+		if (polygon >= 0) {
+			lua_pushinteger(L, index->ids[polygon]);
+		} else {
+			lua_pushboolean(L, 0);
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+static int polygonindex_len (lua_State *L) {
+	h3_polygonindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_POLYGONINDEX);
+	lua_pushinteger(L, index->count);
+	return 1;
+}
+
+static int polygonindex_gc (lua_State *L) {
+	size_t            i;
+	h3_polygonindex  *index;
+
+	index = luaL_checkudata(L, 1, H3_POLYGONINDEX);
+	if (index->polygons != NULL) {
+		for (i = 0; i < index->count; i++) {
+			freegeopolygon(&index->polygons[i]);
+		}
+	}
+	memory_free(index->polygons);
+	memory_free(index->ids);
+	map_free(&index->interior);
+	map_free(&index->boundary);
+	memory_free(index->candidates);
+	return 0;
+}
+
+
+/*
+ * cell counter
+ */
+
+#define CELLCOUNTER_RING(counter, bucket)  /* bucket -> ring position */ \
+		((((bucket) % (counter)->buckets) + (counter)->buckets) % (counter)->buckets)
+
+static int64_t cellcounter_bucket (const h3_cellcounter *counter, double time) {
+	return (int64_t)floor(time / counter->width);
+}
+
+static int64_t *cellcounter_counts (const h3_cellcounter *counter, int64_t s) {
+	return counter->counts + s * counter->buckets;
+}
+
+static int64_t cellcounter_alloc (h3_cellcounter *counter) {
+	int64_t          s, size, *counts;
+	h3_counterslot  *slots;
+
+	if (counter->free >= 0) {
+		s = counter->free;
+		counter->free = counter->slots[s].last;
+	} else {
+		if (counter->used == counter->size) {
+			size = counter->size > 0 ? counter->size * 2 : H3_MAP_MIN;
+			if ((size_t)size > SIZE_MAX / sizeof(int64_t) / counter->buckets) {
+				return -1;
+			}
+			slots = memory_realloc(counter->slots, size * sizeof(h3_counterslot));
+			if (slots == NULL) {
+				return -1;
+			}
+			counter->slots = slots;
+			counts = memory_realloc(counter->counts, size * counter->buckets * sizeof(int64_t));
+			if (counts == NULL) {
+				return -1;
+			}
+			counter->counts = counts;
+			counter->size = size;
+		}
+		s = counter->used++;
+	}
+	memset(cellcounter_counts(counter, s), 0, counter->buckets * sizeof(int64_t));
+	return s;
+}
+
+static void cellcounter_release (h3_cellcounter *counter, int64_t s) {
+	map_remove(&counter->cells, counter->slots[s].cell);
+	counter->slots[s].cell = H3_NULL;
+	counter->slots[s].last = counter->free;
+	counter->free = s;
+}
+
+static void cellcounter_advance (h3_cellcounter *counter, int64_t s, int64_t bucket) {
+	int64_t          b, *counts;
+	h3_counterslot  *slot;
+
+	/* expires the buckets that have left the window ending with the bucket */
+	slot = &counter->slots[s];
+	if (bucket <= slot->last) {
+		return;
+	}
+	counts = cellcounter_counts(counter, s);
+	if (bucket - slot->last >= counter->buckets) {
+		memset(counts, 0, counter->buckets * sizeof(int64_t));
+		slot->total = 0;
+	} else {
+		for (b = slot->last + 1; b <= bucket; b++) {
+			slot->total -= counts[CELLCOUNTER_RING(counter, b)];
+			counts[CELLCOUNTER_RING(counter, b)] = 0;
+		}
+	}
+	slot->last = bucket;
+}
+
+static int64_t cellcounter_total (const h3_cellcounter *counter, int64_t s, int64_t now) {
+	int64_t                b, total;
+	const int64_t         *counts;
+	const h3_counterslot  *slot;
+
+	/* the window ending at now, which is not before the last bucket; the ring is not modified */
+	slot = &counter->slots[s];
+	if (now - slot->last >= counter->buckets) {
+		return 0;
+	}
+	counts = cellcounter_counts(counter, s);
+	total = slot->total;
+	for (b = slot->last - counter->buckets + 1; b <= now - counter->buckets; b++) {
+		total -= counts[CELLCOUNTER_RING(counter, b)];
+	}
+	return total;
+}
+
+static int64_t cellcounter_optnow (lua_State *L, const h3_cellcounter *counter, int index) {
+	int64_t  now;
+
+	/* earlier windows are not retained; expired buckets may have been cleared */
+	if (lua_isnoneornil(L, index)) {
+		return counter->latest;
+	}
+	now = cellcounter_bucket(counter, luaL_checknumber(L, index));
+	luaL_argcheck(L, now >= counter->latest, index, "bad time");
+	return now;
+}
+
+static void cellcounter_sift (h3_cellcount *heap, int64_t num, h3_cellcount entry) {
+	int64_t  i, child;
+
+	/* places the entry at the root of the min-heap and sifts it down */
+	i = 0;
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && heap[child + 1].count < heap[child].count) {
+			child++;
+		}
+		if (heap[child].count >= entry.count) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = entry;
+}
+
+static void cellcounter_push (h3_cellcount *heap, int64_t *num, int64_t n, int64_t count,
+		int64_t slot) {
+	int64_t       i;
+	h3_cellcount  entry;
+
+	/* min-heap on count, holding the n highest counts seen so far */
+	entry.count = count;
+	entry.slot = slot;
+	if (*num < n) {
+		i = (*num)++;
+		while (i > 0 && heap[(i - 1) / 2].count > count) {
+			heap[i] = heap[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap[i] = entry;
+	} else if (count > heap[0].count) {
+		cellcounter_sift(heap, n, entry);
+	}
+}
+
+static int h3_cellcounter_ (lua_State *L) {
+	int              res;
+	lua_Integer      buckets;
+	lua_Number       window;
+	h3_cellcounter  *counter;
+
+	memory_enter(L);
+	res = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, res >= 0 && res <= 15, 1, "bad resolution");
+	window = luaL_checknumber(L, 2);
+	luaL_argcheck(L, window > 0, 2, "bad window");
+	buckets = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, buckets >= 1 && buckets <= H3_BUCKETS_MAX, 3, "bad number of buckets");
+	counter = lua_newuserdata(L, sizeof(h3_cellcounter));
+	memset(counter, 0, sizeof(h3_cellcounter));
+	counter->res = res;
+	counter->buckets = buckets;
+	counter->width = window / buckets;
+	counter->latest = INT64_MIN;
+	counter->free = -1;
+	luaL_getmetatable(L, H3_CELLCOUNTER);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int cellcounter_add (lua_State *L) {
+	size_t           len, i;
+	double           time;
+	LatLng           g;
+	H3Index          cell;
+	int64_t          s, bucket, *counts;
+	h3_value        *value;
+	lua_Integer      added;
+	h3_cellcounter  *counter;
+	h3_counterslot  *slot;
+
+	memory_enter(L);
+	counter = luaL_checkudata(L, 1, H3_CELLCOUNTER);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	len = lua_rawlen(L, 2);
+	time = 0.0;
+	if (lua_type(L, 3) == LUA_TTABLE) {
+		luaL_argcheck(L, lua_rawlen(L, 3) == len, 3, "bad times");
+	} else {
+		time = luaL_checknumber(L, 3);
+	}
+	added = 0;
+	for (i = 0; i < len; i++) {
+		if (lua_rawgeti(L, 2, i + 1) != LUA_TTABLE) {
+			return luaL_error(L, "bad point");
+		}
+		if (lua_rawgeti(L, -1, 1) != LUA_TNUMBER || lua_rawgeti(L, -2, 2) != LUA_TNUMBER) {
+			return luaL_error(L, "bad point");
+		}
+		g.lat = degsToRads(lua_tonumber(L, -2));
+		g.lng = degsToRads(lua_tonumber(L, -1));
+		lua_pop(L, 3);
+		if (lua_type(L, 3) == LUA_TTABLE) {
+			if (lua_rawgeti(L, 3, i + 1) != LUA_TNUMBER) {
+				return luaL_error(L, "bad time");
+			}
+			time = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		check(L, latLngToCell(&g, counter->res, &cell));
+
+		/* events before the window of the latest event are dropped */
+		bucket = cellcounter_bucket(counter, time);
+		if (bucket > counter->latest) {
+			counter->latest = bucket;
+		}
+		if (bucket <= counter->latest - counter->buckets) {
+			continue;
+		}
+		value = map_get(&counter->cells, cell);
+		if (value == NULL) {
+			if ((s = cellcounter_alloc(counter)) < 0) {
+				return luaL_error(L, "out of memory");
+			}
+			if ((value = map_put(&counter->cells, cell)) == NULL) {
+				counter->slots[s].cell = H3_NULL;
+				counter->slots[s].last = counter->free;
+				counter->free = s;
+				return luaL_error(L, "out of memory");
+			}
+			value->i = s;
+			slot = &counter->slots[s];
+			slot->cell = cell;
+			slot->last = bucket;
+			slot->total = 0;
+		} else {
+			s = value->i;
+			slot = &counter->slots[s];
+			cellcounter_advance(counter, s, bucket);
+		}
+		if (bucket <= slot->last - counter->buckets) {
+			continue;
+		}
+		counts = cellcounter_counts(counter, s);
+		counts[CELLCOUNTER_RING(counter, bucket)]++;
+		slot->total++;
+		added++;
+	}
+	lua_pushinteger(L, added);
+	return 1;
+}
+
+static int cellcounter_count (lua_State *L) {
+	int64_t          s, now, total;
+	H3Index          cell;
+	h3_value        *value;
+	h3_cellcounter  *counter;
+
+	counter = luaL_checkudata(L, 1, H3_CELLCOUNTER);
+	cell = luaL_checkinteger(L, 2);
+	now = cellcounter_optnow(L, counter, 3);
+	value = map_get(&counter->cells, cell);
+	if (value == NULL) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+	s = value->i;
+	cellcounter_advance(counter, s, counter->latest);
+	if (counter->slots[s].total == 0) {
+		cellcounter_release(counter, s);
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+	total = cellcounter_total(counter, s, now);
+	lua_pushinteger(L, total);
+	return 1;
+}
+
+static int cellcounter_top (lua_State *L) {
+	int64_t          n, now, s, num, i, total;
+	h3_cellcount    *heap, top;
+	h3_cellcounter  *counter;
+
+	memory_enter(L);
+	counter = luaL_checkudata(L, 1, H3_CELLCOUNTER);
+	n = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, n >= 0, 2, "bad number");
+	now = cellcounter_optnow(L, counter, 3);
+	if (n > (int64_t)counter->cells.count) {
+		n = counter->cells.count;
+	}
+
+	/* releases the cells expired at the latest bucket, and keeps the n highest counts at now */
+	heap = newbuffer(L, (n > 0 ? n : 1) * sizeof(h3_cellcount));
+	num = 0;
+	for (s = 0; s < counter->used; s++) {
+		if (counter->slots[s].cell == H3_NULL) {
+			continue;
+		}
+		cellcounter_advance(counter, s, counter->latest);
+		if (counter->slots[s].total == 0) {
+			cellcounter_release(counter, s);
+			continue;
+		}
+		total = cellcounter_total(counter, s, now);
+		if (n > 0 && total > 0) {
+			cellcounter_push(heap, &num, n, total, s);
+		}
+	}
+
+	/* sort by descending count */
+	for (i = num - 1; i > 0; i--) {
+		top = heap[0];
+		cellcounter_sift(heap, i, heap[i]);
+		heap[i] = top;
+	}
+	lua_createtable(L, num, 0);
+	lua_createtable(L, num, 0);
+	for (i = 0; i < num; i++) {
+		lua_pushinteger(L, counter->slots[heap[i].slot].cell);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushinteger(L, heap[i].count);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+
+static int cellcounter_len (lua_State *L) {
+	h3_cellcounter  *counter;
+
+	counter = luaL_checkudata(L, 1, H3_CELLCOUNTER);
+	lua_pushinteger(L, counter->cells.count);
+	return 1;
+}
+
+static int cellcounter_gc (lua_State *L) {
+	h3_cellcounter  *counter;
+
+	counter = luaL_checkudata(L, 1, H3_CELLCOUNTER);
+	memory_free(counter->slots);
+	memory_free(counter->counts);
+	map_free(&counter->cells);
+	return 0;
+}
+
+
+/*
+ * interface
+ */
+
+int luaopen_h3 (lua_State *L) {
+	int         index;
+	h3_memory  *memory;
+
+	static const luaL_Reg FUNCTIONS[] = {
+		/* version */
 		{"version", h3_version},
 
 		/* indexing */
@@ -1055,33 +5244,51 @@ int luaopen_h3 (lua_State *L) {
 		{"isresclassiii", h3_isresclassiii},
 		{"ispentagon", h3_ispentagon},
 		{"icosahedronfaces", h3_icosahedronfaces},
+		{"resolutions", h3_resolutions},
+		{"basecellnumbers", h3_basecellnumbers},
+		{"iscells", h3_iscells},
 
 		/* traversal */
 		{"griddisk", h3_griddisk},
 		{"gridring", h3_gridring},
 		{"gridpathcells", h3_gridpathcells},
+		{"trajectorytocells", h3_trajectorytocells},
 		{"griddistance", h3_griddistance},
+		{"griddistances", h3_griddistances},
+		{"smoothcells", h3_smoothcells},
 		{"celltolocalij", h3_celltolocalij},
 		{"localijtocell", h3_localijtocell},
+		{"cellstogrid", h3_cellstogrid},
+		{"gridtocells", h3_gridtocells},
 
 		/* hierarchy */
 		{"celltoparent", h3_celltoparent},
+		{"celltoparents", h3_celltoparents},
 		{"celltochildren", h3_celltochildren},
 		{"celltocenterchild", h3_celltocenterchild},
 		{"celltochildpos", h3_celltochildpos},
+		{"celltochildpositions", h3_celltochildpositions},
 		{"childpostocell", h3_childpostocell},
 		{"compactcells", h3_compactcells},
 		{"uncompactcells", h3_uncompactcells},
 
 		/* region */
 		{"polygontocells", h3_polygontocells},
+		{"bboxtocells", h3_bboxtocells},
 		{"cellstopolygons", h3_cellstopolygons},
+		{"cellsperimeter", h3_cellsperimeter},
+		{"diffcells", h3_diffcells},
+		{"cellstotile", h3_cellstotile},
 
 		/* directed edge */
 		{"areneighborcells", h3_areneighborcells},
 		{"cellstoedge", h3_cellstoedge},
 		{"isedge", h3_isedge},
 		{"edgetocells", h3_edgetocells},
+		{"pathtoedges", h3_pathtoedges},
+		{"edgelengths", h3_edgelengths},
+		{"edgestocells", h3_edgestocells},
+		{"aggregateflows", h3_aggregateflows},
 		{"origintoedges", h3_origintoedges},
 		{"edgetoboundary", h3_edgetoboundary},
 
@@ -1089,23 +5296,97 @@ int luaopen_h3 (lua_State *L) {
 		{"celltovertexes", h3_celltovertexes},
 		{"vertextolatlng", h3_vertextolatlng},
 		{"isvertex", h3_isvertex},
+		{"cellstomesh", h3_cellstomesh},
 
 		/* miscellaneous */
 		{"hexagonavg", h3_hexagonavg},
 		{"cellarea", h3_cellarea},
+		{"cellsarea", h3_cellsarea},
 		{"edgelength", h3_edgelength},
 		{"numcells", h3_numcells},
 		{"res0cells", h3_res0cells},
 		{"pentagons", h3_pentagons},
 		{"greatcircledistance", h3_greatcircledistance},
+		{"greatcircledistances", h3_greatcircledistances},
+		{"celldistances", h3_celldistances},
+		{"cellswithinradius", h3_cellswithinradius},
+
+		/* memory */
+		{"memorylimit", h3_memorylimit},
+		{"memoryusage", h3_memoryusage},
+
+		/* point index */
+		{"pointindex", h3_pointindex_},
+
+		/* cell map */
+		{"cellmap", h3_cellmap_},
+
+		/* cell index */
+		{"writecellindex", h3_writecellindex},
+		{"opencellindex", h3_opencellindex},
+
+		/* polygon index */
+		{"polygonindex", h3_polygonindex_},
+
+		/* cell counter */
+		{"cellcounter", h3_cellcounter_},
 		
 		{ NULL, NULL }
 	};
+	static const luaL_Reg POINTINDEX_METHODS[] = {
+		{"insert", pointindex_insert},
+		{"move", pointindex_move},
+		{"remove", pointindex_remove},
+		{"get", pointindex_get},
+		{"knn", pointindex_knn},
+		{ NULL, NULL }
+	};
+	static const luaL_Reg CELLMAP_METHODS[] = {
+		{"get", cellmap_get},
+		{"set", cellmap_set},
+		{"add", cellmap_add},
+		{"cells", cellmap_cells},
+		{"merge", cellmap_merge},
+		{ NULL, NULL }
+	};
+	static const luaL_Reg CELLINDEX_METHODS[] = {
+		{"contains", cellindex_contains},
+		{"lookup", cellindex_lookup},
+		{"reload", cellindex_reload},
+		{ NULL, NULL }
+	};
+	static const luaL_Reg POLYGONINDEX_METHODS[] = {
+		{"label", polygonindex_label},
+		{ NULL, NULL }
+	};
+	static const luaL_Reg CELLCOUNTER_METHODS[] = {
+		{"add", cellcounter_add},
+		{"count", cellcounter_count},
+		{"top", cellcounter_top},
+		{ NULL, NULL }
+	};
+
+	/* memory, shared by the module instances of the state */
+	if (lua_getfield(L, LUA_REGISTRYINDEX, H3_MEMORY) != LUA_TUSERDATA) {
+		lua_pop(L, 1);
+		memory = lua_newuserdata(L, sizeof(h3_memory));
+		memset(memory, 0, sizeof(h3_memory));
+		memory->alloc = lua_getallocf(L, &memory->ud);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, H3_MEMORY);
+	}
+	index = lua_gettop(L);
 
 	/* register functions */
-	luaL_newlib(L, FUNCTIONS);
+	luaL_newlibtable(L, FUNCTIONS);
+	lua_pushvalue(L, index);
+	luaL_setfuncs(L, FUNCTIONS, 1);
 
 	/* metatables */
+	luaL_newmetatable(L, H3_MAP);
+	lua_pushcfunction(L, map_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
 	luaL_newmetatable(L, H3_GEOPOLYGON);
 	lua_pushcfunction(L, geopolygon_gc);
 	lua_setfield(L, -2, "__gc");
@@ -1114,6 +5395,62 @@ int luaopen_h3 (lua_State *L) {
 	lua_pushcfunction(L, linkedgeopolygon_gc);
 	lua_setfield(L, -2, "__gc");
 	lua_pop(L, 1);
+	luaL_newmetatable(L, H3_POINTINDEX);
+	luaL_newlibtable(L, POINTINDEX_METHODS);
+	lua_pushvalue(L, index);
+	luaL_setfuncs(L, POINTINDEX_METHODS, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, pointindex_len);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, pointindex_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, H3_CELLMAP);
+	luaL_newlibtable(L, CELLMAP_METHODS);
+	lua_pushvalue(L, index);
+	luaL_setfuncs(L, CELLMAP_METHODS, 1);
+	lua_pushcclosure(L, cellmap_index, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushvalue(L, index);
+	lua_pushcclosure(L, cellmap_newindex, 1);
+	lua_setfield(L, -2, "__newindex");
+	lua_pushcfunction(L, cellmap_pairs);
+	lua_setfield(L, -2, "__pairs");
+	lua_pushcfunction(L, cellmap_len);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, cellmap_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, H3_CELLINDEX);
+	luaL_newlibtable(L, CELLINDEX_METHODS);
+	lua_pushvalue(L, index);
+	luaL_setfuncs(L, CELLINDEX_METHODS, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, cellindex_len);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, cellindex_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, H3_POLYGONINDEX);
+	luaL_newlibtable(L, POLYGONINDEX_METHODS);
+	lua_pushvalue(L, index);
+	luaL_setfuncs(L, POLYGONINDEX_METHODS, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, polygonindex_len);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, polygonindex_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, H3_CELLCOUNTER);
+	luaL_newlibtable(L, CELLCOUNTER_METHODS);
+	lua_pushvalue(L, index);
+	luaL_setfuncs(L, CELLCOUNTER_METHODS, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, cellcounter_len);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, cellcounter_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
 
 	return 1;
 }
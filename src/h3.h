@@ -9,12 +9,186 @@
 #define _H3_INCLUDED
 
 
+#include <stdint.h>
 #include <lua.h>
+#include <h3/h3api.h>
 
 
 #define H3_GEOPOLYGON        "h3.geopolygon"        /* GeoPolygon metatable */
 #define H3_LINKEDGEOPOLYGON  "h3.linkedgeopolygon"  /* LinkedGeoPolygon metatable */
+#define H3_MAP               "h3.map"               /* scratch map metatable */
+#define H3_POINTINDEX        "h3.pointindex"        /* point index metatable */
+#define H3_CELLMAP           "h3.cellmap"           /* cell map metatable */
+#define H3_CELLINDEX         "h3.cellindex"         /* cell index metatable */
+#define H3_POLYGONINDEX      "h3.polygonindex"      /* polygon index metatable */
+#define H3_CELLCOUNTER       "h3.cellcounter"       /* cell counter metatable */
+#define H3_MEMORY            "h3.memory"            /* memory registry key */
 #define H3_STACK_MAX         128                    /* maximum indexes on stack */
+#define H3_THREADS_MAX       64                     /* maximum worker threads */
+#define H3_MAP_MIN           16                     /* minimum map size */
+#define H3_GRID_RINGS_MAX    1024                   /* maximum radius query rings */
+#define H3_GRID_MAX          (1 << 26)              /* maximum grid entries */
+#define H3_BBOX_SPAN         49                     /* capped cover cells per maximum cell */
+#define H3_EARTH_RADIUS_KM   6371.007180918475      /* authalic earth radius, kilometers */
+#define H3_TILE_LAT          1.4844222297453324     /* maximum Web Mercator latitude, radians */
+#define H3_TILE_GEOMETRY_MAX 128                    /* maximum encoded cell geometry size */
+#define H3_BUCKETS_MAX       65536                  /* maximum cell counter buckets */
+#define H3_CELLINDEX_MAGIC   "LUAH3IX1"             /* cell index file magic */
+#define H3_CELLINDEX_IDS     0x1                    /* cell index file has identifiers */
+
+
+/* array kernels are cloned for AVX2 and selected at load time where supported */
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define H3_KERNEL            __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef H3_KERNEL
+#define H3_KERNEL
+#endif
+
+/* allocation functions for H3 built with a custom allocator prefix, e.g., luah3_ */
+#ifdef H3_ALLOC_PREFIX
+#define H3_MEMORY_JOIN_(prefix, name)  prefix ## name
+#define H3_MEMORY_JOIN(prefix, name)   H3_MEMORY_JOIN_(prefix, name)
+#endif
+
+
+typedef void (*h3_task)(void *arg, int64_t begin, int64_t end);
+
+typedef struct h3_job {
+	h3_task   task;   /* task function */
+	void     *arg;    /* task argument */
+	int64_t   begin;  /* first item */
+	int64_t   end;    /* last item, exclusive */
+} h3_job;
+
+typedef struct h3_memory {
+	lua_Alloc  alloc;    /* Lua allocator */
+	void      *ud;       /* Lua allocator user data */
+	size_t     used;     /* allocated bytes */
+	size_t     base;     /* allocated bytes at the start of the current call */
+	size_t     limit;    /* maximum bytes allocated per call; 0 if unlimited */
+	size_t     buffers;  /* buffer bytes allocated by the current call */
+} h3_memory;
+
+typedef struct h3_block {
+	h3_memory  *memory;  /* memory, or NULL if allocated by the system */
+	size_t      size;    /* size, excluding the block header */
+} h3_block;
+
+typedef union h3_value {
+	int64_t  i;  /* integer value */
+	double   n;  /* number value */
+} h3_value;
+
+typedef struct h3_map {
+	size_t     size;    /* number of slots, power of two */
+	size_t     count;   /* number of entries */
+	H3Index   *keys;    /* keys, H3_NULL if empty */
+	h3_value  *values;  /* values */
+} h3_map;
+
+typedef struct h3_range {
+	H3Index  lo;    /* first descendant, resolution 15 */
+	H3Index  hi;    /* upper bound, resolution 15 */
+	H3Index  cell;  /* cell */
+} h3_range;
+
+typedef struct h3_point {
+	double   lat;   /* latitude, radians */
+	double   lng;   /* longitude, radians */
+	int64_t  id;    /* point identifier */
+	H3Index  cell;  /* containing cell */
+	int64_t  prev;  /* previous point in cell, or next free point; -1 if none */
+	int64_t  next;  /* next point in cell; -1 if none */
+} h3_point;
+
+typedef struct h3_neighbor {
+	double   distance;  /* distance, meters */
+	int64_t  id;        /* point identifier */
+} h3_neighbor;
+
+typedef struct h3_pointindex {
+	int        res;     /* resolution */
+	h3_point  *points;  /* points */
+	size_t     size;    /* number of allocated points */
+	size_t     used;    /* number of used points, including free points */
+	int64_t    free;    /* first free point; -1 if none */
+	h3_map     ids;     /* id -> point */
+	h3_map     cells;   /* cell -> first point */
+} h3_pointindex;
+
+typedef struct h3_cellmap {
+	h3_map  map;      /* cell -> value */
+	int     integer;  /* values are integers */
+} h3_cellmap;
+
+typedef struct h3_cellindexheader {
+	char      magic[8];     /* H3_CELLINDEX_MAGIC */
+	uint64_t  count;        /* number of cells */
+	uint32_t  flags;        /* H3_CELLINDEX_* */
+	uint32_t  resolutions;  /* bit mask of the resolutions of the cells */
+} h3_cellindexheader;
+
+typedef struct h3_cellentry {
+	H3Index  cell;  /* cell */
+	int64_t  id;    /* identifier */
+} h3_cellentry;
+
+typedef struct h3_cellindex {
+	void           *base;         /* mapping, or NULL if closed */
+	size_t          size;         /* mapping size */
+	const H3Index  *cells;        /* sorted cells */
+	const int64_t  *ids;          /* identifiers, or NULL */
+	uint64_t        count;        /* number of cells */
+	uint32_t        resolutions;  /* bit mask of the resolutions of the cells */
+	uint64_t        dev;          /* file device */
+	uint64_t        ino;          /* file inode */
+	int64_t         mtime;        /* file modification time, nanoseconds */
+} h3_cellindex;
+
+typedef struct h3_candidate {
+	int64_t  polygon;  /* polygon */
+	int64_t  next;     /* next candidate; -1 if none */
+} h3_candidate;
+
+typedef struct h3_polygonindex {
+	int            res;          /* resolution */
+	size_t         count;        /* number of polygons */
+	GeoPolygon    *polygons;     /* polygons */
+	int64_t       *ids;          /* polygon identifiers */
+	h3_map         interior;     /* compacted interior cell -> polygon */
+	uint32_t       resolutions;  /* bit mask of the resolutions of the interior cells */
+	h3_map         boundary;     /* boundary cell -> first candidate */
+	h3_candidate  *candidates;   /* candidates */
+	size_t         size;         /* number of allocated candidates */
+	size_t         used;         /* number of used candidates */
+} h3_polygonindex;
+
+typedef struct h3_counterslot {
+	H3Index  cell;   /* cell; H3_NULL if free */
+	int64_t  last;   /* last bucket, or next free slot; -1 if none */
+	int64_t  total;  /* count in the window ending with the last bucket */
+} h3_counterslot;
+
+typedef struct h3_cellcount {
+	int64_t  count;  /* count in the window */
+	int64_t  slot;   /* counter slot */
+} h3_cellcount;
+
+typedef struct h3_cellcounter {
+	int              res;      /* resolution */
+	int              buckets;  /* number of buckets per window */
+	double           width;    /* bucket width */
+	int64_t          latest;   /* latest bucket */
+	h3_map           cells;    /* cell -> slot */
+	h3_counterslot  *slots;    /* slots */
+	int64_t         *counts;   /* counts by slot and bucket */
+	int64_t          size;     /* number of allocated slots */
+	int64_t          used;     /* number of used slots */
+	int64_t          free;     /* first free slot; -1 if none */
+} h3_cellcounter;
 
 
 int luaopen_h3(lua_State *L);
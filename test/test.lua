@@ -36,6 +36,25 @@ assert(not h3.iscell(0))
 assert(not h3.isresclassiii(cell))
 assert(h3.isresclassiii(h3.latlngtocell(LAT, LNG, RES - 1)))
 assert(not h3.ispentagon(cell))
+local cells = { cell, h3.celltoparent(cell, 0), h3.latlngtocell(-LAT, -LNG, 15) }
+local resolutions = h3.resolutions(cells)
+local basecellnumbers = h3.basecellnumbers(cells)
+assert(#resolutions == 3 and #basecellnumbers == 3)
+for i, cell in ipairs(cells) do
+	assert(resolutions[i] == h3.resolution(cell))
+	assert(basecellnumbers[i] == h3.basecellnumber(cell))
+end
+local valid = h3.iscells({ cell, 0, "x", cell + 1 })
+assert(#valid == 4)
+assert(valid[1] and not valid[2] and not valid[3] and valid[4] == h3.iscell(cell + 1))
+local packedcells = string.pack("=i8i8i8", cells[1], cells[2], cells[3])
+assert(h3.resolutions(packedcells) == string.pack("BBB", resolutions[1], resolutions[2],
+		resolutions[3]))
+assert(h3.basecellnumbers(packedcells) == string.pack("BBB", basecellnumbers[1],
+		basecellnumbers[2], basecellnumbers[3]))
+assert(h3.iscells(string.pack("=i8i8i8", cell, 0, cell + 1))
+		== string.pack("BBB", 1, 0, h3.iscell(cell + 1) and 1 or 0))
+assert(not pcall(h3.resolutions, "1234567"))
 local faces = h3.icosahedronfaces(cell)
 assert(#faces > 0)
 for _, face in ipairs(faces) do
@@ -89,9 +108,87 @@ for _, cell in ipairs(cells) do
 end
 local distance = h3.griddistance(cell, cell1)
 assert(distance == #cells - 1)
+local points = {}
+for i = 0, 100 do
+	points[#points + 1] = { LAT + i * 0.001, LNG + i * 0.001 }
+	points[#points + 1] = { LAT + i * 0.001, LNG + i * 0.001 }
+end
+points[#points + 1] = { LAT + 0.2, LNG + 0.2 }
+local trajectory, entries = h3.trajectorytocells(points, RES)
+assert(#trajectory > 10 and #trajectory == #entries)
+assert(trajectory[1] == h3.latlngtocell(LAT, LNG, RES) and entries[1] == 1)
+assert(trajectory[#trajectory] == h3.latlngtocell(LAT + 0.2, LNG + 0.2, RES))
+assert(entries[#entries] == #points)
+for i = 2, #trajectory do
+	assert(h3.areneighborcells(trajectory[i - 1], trajectory[i]))
+	assert(entries[i - 1] <= entries[i])
+end
+assert(entries[#entries - 1] == #points - 1)
+local packedpoints = {}
+for i, point in ipairs(points) do
+	packedpoints[i] = string.pack("=dd", point[1], point[2])
+end
+local packedtrajectory, packedentries = h3.trajectorytocells(table.concat(packedpoints), RES)
+assert(#packedtrajectory == #trajectory and #packedentries == #entries)
+for i = 1, #trajectory do
+	assert(packedtrajectory[i] == trajectory[i] and packedentries[i] == entries[i])
+end
+assert(#h3.trajectorytocells({}, RES) == 0)
+assert(not pcall(h3.trajectorytocells, "1234567", RES))
+local origins, dests = { cell, cell1 }, h3.griddisk(cell, 2)
+for _, threads in ipairs({ 1, 2 }) do
+	local distances = h3.griddistances(origins, dests, threads)
+	assert(#distances == #origins * #dests)
+	for i, origin in ipairs(origins) do
+		for j, dest in ipairs(dests) do
+			assert(distances[(i - 1) * #dests + j] == h3.griddistance(origin, dest))
+		end
+	end
+end
+distances = h3.griddistances(origins, dests)
+local packed = h3.griddistances(origins, dests, 2, "packed")
+assert(#packed == 4 * #distances)
+for k = 1, #distances do
+	assert(string.unpack("=i4", packed, 4 * k - 3) == distances[k])
+end
+assert(#h3.griddistances({}, dests) == 0)
 local i, j = h3.celltolocalij(cell, cell1)
 assert(math.type(i) == "integer" and math.type(j) == "integer")
 assert(h3.localijtocell(cell, i, j) == cell1)
+local disk = h3.griddisk(cell, 2)
+local diskvalues = {}
+for k = 1, #disk do
+	diskvalues[k] = k
+end
+local grid, width, height, imin, jmin = h3.cellstogrid(cell, disk, diskvalues)
+assert(width == 5 and height == 5 and #grid == 25)
+local gi, gj = h3.celltolocalij(cell, disk[3])
+assert(grid[(gj - jmin) * width + (gi - imin) + 1] == 3)
+local gridcells, gridvalues = h3.gridtocells(cell, grid, width, imin, jmin)
+assert(#gridcells == #disk and #gridvalues == #disk)
+for k = 1, #gridcells do
+	assert(disk[gridvalues[k]] == gridcells[k])
+end
+local packedgrid = h3.cellstogrid(cell, disk, diskvalues, nil, "packed")
+assert(#packedgrid == 8 * #grid)
+for k = 1, #grid do
+	assert(string.unpack("=d", packedgrid, 8 * k - 7) == grid[k])
+end
+local packedcells, packedvalues = h3.gridtocells(cell, packedgrid, width, imin, jmin)
+assert(#packedcells == #disk and #packedvalues == #disk)
+for k = 1, #packedcells do
+	assert(packedcells[k] == gridcells[k] and packedvalues[k] == gridvalues[k])
+end
+local smoothed = h3.smoothcells({ cell, disk[2] }, { 1, 2 }, { 1, 0.5 })
+assert(#smoothed == 2)
+assert(math.abs(smoothed[1] - 2) < TOL and math.abs(smoothed[2] - 2.5) < TOL)
+local smoothedtouched, touchedcells, touchedvalues = h3.smoothcells({ cell }, { 2 }, { 1, 0.5 },
+		true, 2)
+assert(smoothedtouched[1] == 2)
+assert(#touchedcells == 6 and #touchedvalues == 6)
+for k = 1, #touchedcells do
+	assert(h3.griddistance(cell, touchedcells[k]) == 1 and touchedvalues[k] == 1)
+end
 
 -- hierarchy
 local cell = h3.latlngtocell(LAT, LNG, RES)
@@ -99,6 +196,17 @@ local parent = h3.celltoparent(cell, RES - 1)
 assert(h3.resolution(parent) == RES - 1)
 local children = h3.celltochildren(parent, RES)
 assert(#children == 7)
+for res = 0, RES do
+	local parents = h3.celltoparents(children, res)
+	assert(#parents == 7)
+	for i, child in ipairs(children) do
+		assert(parents[i] == h3.celltoparent(child, res))
+	end
+end
+assert(not pcall(h3.celltoparents, { cell, parent }, RES))
+local packedparents = h3.celltoparents(string.pack("=i8i8", children[1], children[2]), RES - 1)
+assert(packedparents == string.pack("=i8i8", parent, parent))
+assert(not pcall(h3.celltoparents, { cell }, 16))
 local found = nil
 for _, child in ipairs(children) do
 	if child == cell then
@@ -113,6 +221,13 @@ assert(distance == 0 or distance == 1)
 local childpos = h3.celltochildpos(children[2], RES - 1)
 assert(childpos >= 0)
 assert(h3.childpostocell(childpos, parent, RES) == children[2])
+local childpositions = h3.celltochildpositions(children, RES - 1)
+assert(#childpositions == 7)
+for i, child in ipairs(children) do
+	assert(childpositions[i] == h3.celltochildpos(child, RES - 1))
+end
+assert(h3.celltochildpositions(string.pack("=i8", children[2]), RES - 1)
+		== string.pack("=i8", childpos))
 local compactcells = h3.compactcells(children)
 assert(#compactcells == 1)
 assert(compactcells[1] == parent)
@@ -121,6 +236,20 @@ assert(#uncompactcells == 7)
 for _, cell in ipairs(uncompactcells) do
 	h3.iscell(cell)
 end
+local pentagon = h3.pentagons(RES - 1)[1]
+children = h3.celltochildren(pentagon, RES + 1)
+table.insert(children, h3.celltocenterchild(parent, RES + 1))
+compactcells = h3.compactcells(children, 4)
+assert(#compactcells == 2)
+uncompactcells = h3.uncompactcells(compactcells, RES + 1)
+assert(#uncompactcells == #children)
+table.sort(children)
+table.sort(uncompactcells)
+for i = 1, #children do
+	assert(uncompactcells[i] == children[i])
+end
+assert(not pcall(h3.compactcells, { parent, children[1] }))
+assert(not pcall(h3.compactcells, { children[1], children[1] }))
 
 -- region
 local ring = {
@@ -148,6 +277,38 @@ assert(#partialCells < #cells)
 for _, cell in ipairs(cells) do
 	assert(h3.iscell(cell))
 end
+local bboxcells = h3.bboxtocells(LAT, LNG, LAT + 1, LNG + 1, 6)
+assert(#bboxcells > 0)
+for _, cell in ipairs(bboxcells) do
+	local lat, lng = h3.celltolatlng(cell)
+	assert(lat >= LAT and lat <= LAT + 1 and lng >= LNG and lng <= LNG + 1)
+end
+local capped = h3.bboxtocells(LAT, LNG, LAT + 1, LNG + 1, 6, 1)
+assert(#capped >= 1)
+capped = h3.bboxtocells(LAT, LNG, LAT + 1, LNG + 1, 6, 50)
+assert(#capped > 0 and #capped <= 50)
+local covered = {}
+for _, cell in ipairs(capped) do
+	covered[cell] = true
+end
+for _, cell in ipairs(bboxcells) do
+	local found = false
+	for res = 0, 6 do
+		found = found or covered[h3.celltoparent(cell, res)] == true
+	end
+	assert(found)
+end
+assert(#h3.bboxtocells(LAT, LNG, LAT + 0.001, LNG + 0.001, 2, 10) == 1)
+local continent = h3.bboxtocells(25, -125, 50, -65, 9, 100)
+assert(#continent > 0 and #continent <= 100)
+local crossing = h3.bboxtocells(-1, 179, 1, -179, 4)
+local east, west = false, false
+for _, cell in ipairs(crossing) do
+	local _, lng = h3.celltolatlng(cell)
+	east = east or lng > 0
+	west = west or lng < 0
+end
+assert(east and west)
 local polygons = h3.cellstopolygons(cells)
 assert(#polygons == 1)
 local polygon = polygons[1]
@@ -159,6 +320,135 @@ for _, latLng in ipairs(ring) do
 	assert(math.abs(latLng[1] - LAT) < 1 + TOL)
 	assert(math.abs(latLng[2] - LNG) < 1 + TOL)
 end
+disk = h3.griddisk(h3.latlngtocell(LAT, LNG, RES), 2)
+local boundary, edges, perimeter = h3.cellsperimeter(disk)
+assert(#boundary == 12 and #edges == 30)
+local length = 0
+for _, edge in ipairs(edges) do
+	local origin, destination = h3.edgetocells(edge)
+	local found = nil
+	for _, cell in ipairs(boundary) do
+		found = found or cell == origin
+	end
+	assert(found)
+	for _, cell in ipairs(disk) do
+		assert(cell ~= destination)
+	end
+	length = length + h3.edgelength(edge)
+end
+assert(math.abs(perimeter - length) < 1e-06)
+local _, _, perimeterKm = h3.cellsperimeter(disk, "km")
+assert(math.abs(perimeter / perimeterKm - 1000) < 1e-06)
+assert(not pcall(h3.cellsperimeter, { disk[1], disk[1] }))
+local diffparent = h3.celltoparent(disk[1], RES - 1)
+local diffchildren = h3.celltochildren(diffparent, RES)
+local added, removed = h3.diffcells({ diffparent }, { diffchildren[1], diffchildren[2] })
+assert(#added == 0 and #removed == 5)
+for _, cell in ipairs(removed) do
+	assert(h3.celltoparent(cell, RES - 1) == diffparent)
+	assert(cell ~= diffchildren[1] and cell ~= diffchildren[2])
+end
+added, removed = h3.diffcells({ diffchildren[1] }, { diffparent })
+assert(#added == 6 and #removed == 0)
+added, removed = h3.diffcells(h3.compactcells(diffchildren), diffchildren)
+assert(#added == 0 and #removed == 0)
+local tilez = 10
+local tilex = math.floor((LNG + 180) / 360 * 2 ^ tilez)
+local tiley = math.floor((1 - math.log(math.tan(math.rad(LAT)) + 1 / math.cos(math.rad(LAT)))
+		/ math.pi) / 2 * 2 ^ tilez)
+local tile, numfeatures = h3.cellstotile(disk, diskvalues, tilez, tilex, tiley)
+assert(type(tile) == "string" and #tile > 0 and tile:byte(1) == 0x1a)
+assert(numfeatures > 0 and numfeatures <= #disk)
+local _, emptyfeatures = h3.cellstotile(disk, nil, tilez, (tilex + 512) % 1024, tiley)
+assert(emptyfeatures == 0)
+local function tilefields (data)
+	local fields, i = {}, 1
+	local function varint ()
+		local value, shift, byte = 0, 0
+		repeat
+			byte = data:byte(i)
+			i = i + 1
+			value = value | (byte & 0x7f) << shift
+			shift = shift + 7
+		until byte < 0x80
+		return value
+	end
+	while i <= #data do
+		local key = varint()
+		local value
+		if key & 7 == 0 then
+			value = varint()
+		elseif key & 7 == 1 then
+			value = data:sub(i, i + 7)
+			i = i + 8
+		else
+			local len = varint()
+			value = data:sub(i, i + len - 1)
+			i = i + len
+		end
+		table.insert(fields, { key >> 3, value })
+	end
+	return fields
+end
+local function tilepacked (data)
+	local values, i = {}, 1
+	while i <= #data do
+		local value, shift, byte = 0, 0
+		repeat
+			byte = data:byte(i)
+			i = i + 1
+			value = value | (byte & 0x7f) << shift
+			shift = shift + 7
+		until byte < 0x80
+		table.insert(values, value)
+	end
+	return values
+end
+local layer = tilefields(tile)[1][2]
+local features, tilevalues = {}, {}
+for _, field in ipairs(tilefields(layer)) do
+	if field[1] == 2 then
+		local feature = {}
+		for _, ffield in ipairs(tilefields(field[2])) do
+			feature[ffield[1]] = ffield[2]
+		end
+		table.insert(features, feature)
+	elseif field[1] == 4 then
+		table.insert(tilevalues, (string.unpack("<d", tilefields(field[2])[1][2])))
+	end
+end
+assert(#features == numfeatures)
+local feature = features[1]
+local featureindex = nil
+for i, cell in ipairs(disk) do
+	if cell == feature[1] then
+		featureindex = i
+	end
+end
+assert(featureindex and feature[3] == 3)
+local tags = tilepacked(feature[2])
+assert(#tags == 2 and tags[1] == 0 and tilevalues[tags[2] + 1] == diskvalues[featureindex])
+local commands = tilepacked(feature[4])
+assert(commands[1] == 9 and commands[4] & 7 == 2 and commands[#commands] == 15)
+assert(#commands == 5 + 2 * (commands[4] >> 3))
+local px, py = 0, 0
+for i = 2, #commands - 1 do
+	if i ~= 4 then
+		local delta = commands[i] >> 1 ~ -(commands[i] & 1)
+		if (i < 4 and i % 2 == 0) or (i > 4 and i % 2 == 1) then
+			px = px + delta
+			assert(px >= -64 and px <= 4096 + 64)
+		else
+			py = py + delta
+			assert(py >= -64 and py <= 4096 + 64)
+		end
+	end
+end
+local deep, deepfeatures = h3.cellstotile({ h3.latlngtocell(LAT, LNG, 2) }, nil, 20,
+		math.floor((LNG + 180) / 360 * 2 ^ 20),
+		math.floor((1 - math.log(math.tan(math.rad(LAT)) + 1 / math.cos(math.rad(LAT)))
+		/ math.pi) / 2 * 2 ^ 20))
+assert(deepfeatures == 1)
 local polygons = h3.cellstopolygons(partialCells)
 assert(#polygons == 1)
 local polygon = polygons[1]
@@ -206,6 +496,23 @@ for _, entry in ipairs(boundary) do
 	assert(math.abs(entry[1] - LAT) < TOL)
 	assert(math.abs(entry[2] - LNG) < TOL)
 end
+local path = { center, neighbor, center }
+edges = h3.pathtoedges(path)
+assert(#edges == 2 and edges[1] == edge)
+assert(edges[2] == h3.cellstoedge(neighbor, center))
+assert(#h3.pathtoedges({ center }) == 0)
+assert(not pcall(h3.pathtoedges, { center, center }))
+local lengths = h3.edgelengths(edges, "km")
+assert(#lengths == 2 and lengths[1] == h3.edgelength(edge, "km"))
+local origins, destinations = h3.edgestocells(edges)
+assert(origins[1] == center and destinations[1] == neighbor)
+assert(origins[2] == neighbor and destinations[2] == center)
+local flows = h3.aggregateflows({ path, { center, neighbor } }, { 2, 3 })
+assert(#flows == 2)
+assert(flows[edge] == 5 and flows[edges[2]] == 2)
+flows = h3.aggregateflows({ path }, 1, h3.cellmap("integer"))
+assert(flows[edge] == 1 and math.type(flows[edge]) == "integer")
+assert(not pcall(h3.aggregateflows, { path }, { 1.5 }, h3.cellmap("integer")))
 
 -- vertex
 local cell = h3.latlngtocell(LAT, LNG, RES)
@@ -224,6 +531,14 @@ assert(found)
 local lat, lng = h3.vertextolatlng(vertex)
 assert(math.abs(lat - LAT) < TOL)
 assert(math.abs(lng - LNG) < TOL)
+local coords, triangles, meshvertexes = h3.cellstomesh(h3.griddisk(cell, 1))
+assert(#meshvertexes == 24 and #coords == 24 * 2 * 4 and #triangles == 7 * 4 * 3 * 4)
+local meshlng, meshlat = string.unpack("=ff", coords)
+lat, lng = h3.vertextolatlng(meshvertexes[1])
+assert(math.abs(meshlat - lat) < TOL and math.abs(meshlng - lng) < TOL)
+for k = 1, #triangles, 4 do
+	assert(string.unpack("=I4", triangles, k) < #meshvertexes)
+end
 
 -- miscellaneous
 local areaAvgM = h3.hexagonavg(RES, "area")
@@ -244,6 +559,22 @@ assert(math.abs(cellAreaKm - areaAvgKm) < 0.1)
 assert(math.abs(cellAreaM / cellAreaKm - 1000000) < 1e-06)
 local cellAreaRad = h3.cellarea(cell, "rad")
 assert(cellAreaRad > 0 and cellAreaRad < 1e-07)
+parent = h3.celltoparent(cell, RES - 1)
+cells = h3.griddisk(parent, 1)
+cells[#cells + 1] = h3.celltochildren(cells[2], RES)[1]
+local area = 0
+for _, cell in ipairs(cells) do
+	area = area + h3.cellarea(cell)
+end
+for _, threads in ipairs({ 1, 3, 64 }) do
+	local total, counts = h3.cellsarea(cells, "m", threads)
+	assert(math.abs(total - area) < 1e-03)
+	assert(counts[RES - 1] == 7 and counts[RES] == 1 and counts[RES + 1] == nil)
+end
+local totalKm = h3.cellsarea(cells, "km")
+assert(math.abs(area / totalKm - 1000000) < 1e-03)
+local total, counts = h3.cellsarea({})
+assert(total == 0 and next(counts) == nil)
 local edges = h3.origintoedges(cell)
 local edge = edges[1]
 local edgeLengthM = h3.edgelength(edge)
@@ -273,3 +604,264 @@ assert(distanceKm >= 100 and distanceKm <= 150)
 assert(math.abs(distanceM / distanceKm - 1000) < 1e-06)
 local distanceRad = h3.greatcircledistance(LAT, LNG, LAT + 1, LNG + 1, "rad")
 assert(distanceRad >= 0.01 and distanceRad <= 0.03)
+distances = h3.greatcircledistances(LAT, LNG, { { LAT, LNG }, { LAT + 1, LNG + 1 } })
+assert(#distances == 2 and distances[1] == 0)
+assert(math.abs(distances[2] - distanceM) < 1e-06)
+distances = h3.greatcircledistances(LAT, LNG, { { LAT + 1, LNG + 1 } }, "km")
+assert(math.abs(distances[1] - distanceKm) < 1e-09)
+assert(not pcall(h3.greatcircledistances, LAT, LNG, { { LAT } }))
+origin = h3.latlngtocell(LAT, LNG, RES)
+local olat, olng = h3.celltolatlng(origin)
+distances = h3.celldistances(LAT, LNG, { origin })
+assert(#distances == 1)
+assert(math.abs(distances[1] - h3.greatcircledistance(LAT, LNG, olat, olng)) < 1e-06)
+local radius = 3 * h3.hexagonavg(RES, "edge")
+cells, distances = h3.cellswithinradius(LAT, LNG, radius, RES)
+assert(#cells > 1 and #cells == #distances)
+local within = {}
+for i, cell in ipairs(cells) do
+	assert(distances[i] <= radius)
+	within[cell] = true
+end
+for _, cell in ipairs(h3.griddisk(origin, 6)) do
+	local lat, lng = h3.celltolatlng(cell)
+	assert(within[cell] == (h3.greatcircledistance(LAT, LNG, lat, lng) <= radius or nil))
+end
+assert(#h3.cellswithinradius(LAT, LNG, radius / 1000, RES, "km") == #cells)
+assert(#h3.cellswithinradius(LAT, LNG, 0, RES) <= 1)
+
+-- memory
+assert(h3.memorylimit() == 0)
+local usage = h3.memoryusage()
+assert(math.type(usage) == "integer" and usage >= 0)
+local memorymap = h3.cellmap()
+for _, cell in ipairs(h3.griddisk(h3.latlngtocell(LAT, LNG, RES), 10)) do
+	memorymap[cell] = 1
+end
+assert(h3.memoryusage() > usage)
+assert(h3.memorylimit(1024) == 0)
+local ok, err = pcall(function ()
+	local limited = h3.cellmap()
+	for _, cell in ipairs(h3.griddisk(h3.latlngtocell(LAT, LNG, RES), 20)) do
+		limited[cell] = 1
+	end
+end)
+assert(not ok and err:find("out of memory"))
+assert(not pcall(h3.griddisk, h3.latlngtocell(LAT, LNG, RES), 50))
+assert(h3.memorylimit(0) == 1024)
+memorymap = nil
+collectgarbage()
+assert(h3.memoryusage() <= usage)
+
+-- point index
+local index = h3.pointindex(RES)
+assert(#index == 0)
+local ids, distances = index:knn(LAT, LNG, 3)
+assert(#ids == 0 and #distances == 0)
+for i = 1, 100 do
+	index:insert(i, LAT + (i - 1) % 10 * 0.01, LNG + (i - 1) // 10 * 0.01)
+end
+assert(#index == 100)
+assert(not pcall(index.insert, index, 1, LAT, LNG))
+lat, lng = index:get(2)
+assert(math.abs(lat - (LAT + 0.01)) < 1e-09 and math.abs(lng - LNG) < 1e-09)
+assert(index:get(101) == nil)
+ids, distances = index:knn(LAT, LNG, 3)
+assert(#ids == 3 and #distances == 3)
+assert(ids[1] == 1 and distances[1] < 1)
+assert(ids[2] == 11 and ids[3] == 2)
+assert(distances[1] <= distances[2] and distances[2] <= distances[3])
+for i, id in ipairs(ids) do
+	local lat, lng = index:get(id)
+	assert(math.abs(distances[i] - h3.greatcircledistance(LAT, LNG, lat, lng)) < 1e-06)
+end
+ids = index:knn(LAT, LNG, 200)
+assert(#ids == 100)
+ids = index:knn(LAT, LNG, 10, 100)
+assert(#ids == 1 and ids[1] == 1)
+index:move(1, LAT + 1, LNG + 1)
+ids = index:knn(LAT, LNG, 1)
+assert(#ids == 1 and ids[1] == 11)
+ids = index:knn(LAT + 1, LNG + 1, 1)
+assert(ids[1] == 1)
+assert(not pcall(index.move, index, 101, LAT, LNG))
+assert(not pcall(index.insert, index, math.mininteger, LAT, LNG))
+local sparse = h3.pointindex(RES)
+sparse:insert(1, LAT, LNG)
+sparse:insert(2, -LAT, LNG - 180)
+ids, distances = sparse:knn(LAT, LNG, 2)
+assert(#ids == 2 and ids[1] == 1 and ids[2] == 2)
+assert(distances[2] > 10000000)
+assert(index:remove(1))
+assert(not index:remove(1))
+assert(#index == 99)
+ids = index:knn(LAT + 1, LNG + 1, 1, 1000)
+assert(#ids == 0)
+
+-- cell map
+cell = h3.latlngtocell(LAT, LNG, RES)
+parent = h3.celltoparent(cell, RES - 1)
+children = h3.celltochildren(parent, RES)
+local map = h3.cellmap()
+assert(#map == 0 and map[cell] == nil)
+map[cell] = 1.5
+assert(#map == 1 and map[cell] == 1.5)
+map[cell] = nil
+assert(#map == 0 and map[cell] == nil)
+map:set(children, 2)
+assert(#map == 7)
+map:add(children, { 1, 2, 3, 4, 5, 6, 7 })
+local values = map:get(children)
+for i, value in ipairs(values) do
+	assert(value == i + 2)
+end
+values = map:get({ parent, children[1] }, -1)
+assert(values[1] == -1 and values[2] == 3)
+local count, sum = 0, 0
+for cell, value in pairs(map) do
+	assert(h3.celltoparent(cell, RES - 1) == parent)
+	count, sum = count + 1, sum + value
+end
+assert(count == 7 and sum == 42)
+cells, values = map:cells()
+assert(#cells == 7 and #values == 7)
+for i, cell in ipairs(cells) do
+	assert(map[cell] == values[i])
+end
+local merged = map:merge(RES - 1)
+assert(#merged == 1 and merged[parent] == 42)
+assert(map:merge(RES - 1, "min")[parent] == 3)
+assert(map:merge(RES - 1, "max")[parent] == 9)
+assert(not pcall(map.merge, map, RES + 1))
+counts = h3.cellmap("integer")
+counts:add(children, 1)
+counts:add(children, 1)
+assert(counts[children[1]] == 2 and math.type(counts[children[1]]) == "integer")
+assert(not pcall(function () counts[cell] = 1.5 end))
+assert(not pcall(counts.set, counts, children, { 1.5 }))
+
+-- cell index
+path = os.tmpname()
+cell = h3.latlngtocell(LAT, LNG, RES)
+parent = h3.celltoparent(cell, RES - 1)
+local other = h3.latlngtocell(LAT + 1, LNG + 1, RES)
+h3.writecellindex(path, { other, parent }, { 20, 10 })
+index = h3.opencellindex(path)
+assert(#index == 2)
+assert(index:contains(parent) and index:contains(cell) and index:contains(other))
+assert(not index:contains(h3.celltoparent(cell, RES - 2)))
+assert(not index:contains(h3.latlngtocell(LAT - 1, LNG - 1, RES)))
+local id, match = index:lookup(cell)
+assert(id == 10 and match == parent)
+assert(index:lookup(other) == 20)
+assert(index:lookup(h3.latlngtocell(LAT - 1, LNG - 1, RES)) == nil)
+assert(not index:reload())
+h3.writecellindex(path, { cell })
+assert(index:contains(other))
+assert(index:reload())
+assert(#index == 1 and not index:contains(other))
+id, match = index:lookup(h3.celltochildren(cell, RES + 1)[1])
+assert(id == 1 and match == cell)
+assert(not pcall(h3.writecellindex, path, { cell, cell }))
+assert(#h3.opencellindex(path) == 1)
+os.remove(path)
+assert(not pcall(h3.opencellindex, path))
+
+-- polygon index
+west = {
+	{ LAT, LNG },
+	{ LAT, LNG + 0.1 },
+	{ LAT + 0.1, LNG + 0.1 },
+	{ LAT + 0.1, LNG },
+	{ LAT, LNG }
+}
+east = {
+	{ LAT, LNG + 0.1 },
+	{ LAT, LNG + 0.2 },
+	{ LAT + 0.1, LNG + 0.2 },
+	{ LAT + 0.1, LNG + 0.1 },
+	{ LAT, LNG + 0.1 }
+}
+hole = {
+	{ LAT + 0.04, LNG + 0.04 },
+	{ LAT + 0.06, LNG + 0.04 },
+	{ LAT + 0.06, LNG + 0.06 },
+	{ LAT + 0.04, LNG + 0.06 },
+	{ LAT + 0.04, LNG + 0.04 }
+}
+index = h3.polygonindex({ { west, hole }, { east } }, { 7, 9 }, RES)
+assert(#index == 2)
+ids = index:label({
+	{ LAT + 0.02, LNG + 0.02 },
+	{ LAT + 0.05, LNG + 0.05 },
+	{ LAT + 0.05, LNG + 0.15 },
+	{ LAT + 0.05, LNG + 0.0999 },
+	{ LAT + 0.05, LNG + 0.1001 },
+	{ LAT + 0.2, LNG + 0.05 },
+	{ LAT + 0.0399, LNG + 0.05 },
+})
+assert(#ids == 7)
+assert(ids[1] == 7 and ids[2] == false and ids[3] == 9)
+assert(ids[4] == 7 and ids[5] == 9)
+assert(ids[6] == false and ids[7] == 7)
+assert(#index:label({}) == 0)
+local labels = index:label(string.pack("=dddd", LAT + 0.02, LNG + 0.02, LAT + 0.2, LNG + 0.05),
+		"packed")
+assert(labels == string.pack("=i8i8", 7, math.mininteger))
+assert(index:label(string.pack("=dd", LAT + 0.05, LNG + 0.15))[1] == 9)
+assert(not pcall(h3.polygonindex, { { west } }, {}, RES))
+assert(not pcall(h3.polygonindex, { { east } }, { math.mininteger }, RES))
+local sliver = {
+	{ LAT, LNG },
+	{ LAT, LNG + 0.1 },
+	{ LAT + 0.0001, LNG + 0.1 },
+	{ LAT + 0.0001, LNG },
+	{ LAT, LNG }
+}
+local meridian = {
+	{ 10, 179.5 },
+	{ 10, -179.5 },
+	{ 11, -179.5 },
+	{ 11, 179.5 },
+	{ 10, 179.5 }
+}
+index = h3.polygonindex({ { sliver }, { meridian } }, { 1, 2 }, RES)
+ids = index:label({
+	{ LAT + 0.00005, LNG + 0.05 },
+	{ LAT + 0.0002, LNG + 0.05 },
+	{ 10.5, 179.9 },
+	{ 10.5, -179.9 },
+	{ 10.5, 0 }
+})
+assert(ids[1] == 1 and ids[2] == false)
+assert(ids[3] == 2 and ids[4] == 2 and ids[5] == false)
+
+-- cell counter
+local counter = h3.cellcounter(RES, 60, 4)
+assert(#counter == 0)
+local here = h3.latlngtocell(LAT, LNG, RES)
+assert(counter:add({ { LAT, LNG }, { LAT, LNG }, { LAT + 1, LNG } }, 0) == 3)
+assert(#counter == 2)
+assert(counter:count(here) == 2)
+assert(counter:add({ { LAT, LNG } }, { 30 }) == 1)
+assert(counter:count(here) == 3)
+cells, counts = counter:top(1)
+assert(#cells == 1 and cells[1] == here and counts[1] == 3)
+assert(counter:count(here, 75) == 1)
+assert(counter:count(here) == 3)
+assert(counter:add({ { LAT, LNG } }, -60) == 0)
+assert(counter:count(here, 1000) == 0)
+cells, counts = counter:top(10, 1000)
+assert(#cells == 0 and #counts == 0)
+assert(#counter == 2)
+assert(not pcall(counter.count, counter, here, 0))
+assert(counter:add({ { LAT, LNG } }, 1000) == 1)
+assert(counter:count(here) == 1)
+assert(#counter:top(10) == 1 and #counter == 1)
+counter = h3.cellcounter(RES, 60, 4)
+counter:add({ { LAT, LNG } }, 0)
+assert(counter:count(here, 75) == 0)
+counter:add({ { LAT, LNG } }, 45)
+assert(counter:count(here) == 2)
+assert(not pcall(h3.cellcounter, RES, 0, 4))
+assert(not pcall(counter.add, counter, { { LAT } }, 0))